@@ -0,0 +1,162 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Boot path memory arena
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/* Number of pages backing the arena */
+#define ARENA_PAGES         16
+
+/*
+ * The boot path performs many small and short-lived allocations, which we
+ * service from a single set of pages rather than from the firmware pool.
+ * Allocations are bumped from the start of the arena and, since they are
+ * mostly released in reverse order, freeing the topmost one rewinds the
+ * arena. Once there are no outstanding allocations, the arena is empty.
+ * Requests that don't fit fall back to the regular pool.
+ */
+typedef struct {
+	UINTN Size;
+	UINTN Padding;
+} ARENA_HEADER;
+
+STATIC struct {
+	EFI_PHYSICAL_ADDRESS Base;
+	UINTN Size;
+	UINTN Offset;
+	UINTN Outstanding;
+	UINTN Peak;
+	UINTN PoolAllocations;
+} Arena = { 0 };
+
+#define ARENA_ALIGN(n)      (((n) + sizeof(ARENA_HEADER) - 1) & ~(sizeof(ARENA_HEADER) - 1))
+#define IS_IN_ARENA(p)      ((Arena.Base != 0) && ((UINTN)(p) >= (UINTN)Arena.Base) && \
+                             ((UINTN)(p) < (UINTN)Arena.Base + Arena.Size))
+
+/*
+ * Allocate the pages backing the arena.
+ * If this fails, all allocations are simply serviced from the pool.
+ */
+EFI_STATUS ArenaInit(VOID)
+{
+	EFI_STATUS Status;
+
+	if (Arena.Base != 0)
+		return EFI_SUCCESS;
+	Status = gBS->AllocatePages(AllocateAnyPages, EfiBootServicesData, ARENA_PAGES, &Arena.Base);
+	if (EFI_ERROR(Status)) {
+		Arena.Base = 0;
+		return Status;
+	}
+	Arena.Size = EFI_PAGES_TO_SIZE(ARENA_PAGES);
+	Arena.Offset = 0;
+	return EFI_SUCCESS;
+}
+
+/*
+ * Allocate Size bytes from the arena.
+ * The returned value must be freed with ArenaFree().
+ */
+VOID* ArenaAllocate(CONST UINTN Size)
+{
+	ARENA_HEADER* Header;
+	UINTN Needed = sizeof(ARENA_HEADER) + ARENA_ALIGN(Size);
+	VOID* Ptr;
+
+	if ((Arena.Base == 0) || (Size == 0) || (Needed < Size) || (Needed > Arena.Size - Arena.Offset)) {
+		Ptr = AllocatePool(Size);
+		if (Ptr != NULL) {
+			Arena.Outstanding++;
+			Arena.PoolAllocations++;
+		}
+		return Ptr;
+	}
+
+	Header = (ARENA_HEADER*)(UINTN)(Arena.Base + Arena.Offset);
+	Header->Size = Needed;
+	Arena.Offset += Needed;
+	Arena.Outstanding++;
+	if (Arena.Offset > Arena.Peak)
+		Arena.Peak = Arena.Offset;
+	return &Header[1];
+}
+
+/*
+ * Same as ArenaAllocate(), with the returned buffer zeroed.
+ */
+VOID* ArenaAllocateZero(CONST UINTN Size)
+{
+	VOID* Ptr = ArenaAllocate(Size);
+
+	if (Ptr != NULL)
+		ZeroMem(Ptr, Size);
+	return Ptr;
+}
+
+/*
+ * Release an allocation obtained from ArenaAllocate().
+ */
+VOID ArenaFree(VOID* Ptr)
+{
+	ARENA_HEADER* Header;
+
+	if (Ptr == NULL)
+		return;
+	if (Arena.Outstanding > 0)
+		Arena.Outstanding--;
+
+	if (!IS_IN_ARENA(Ptr)) {
+		FreePool(Ptr);
+		return;
+	}
+
+	// Rewind if this was the topmost allocation, or if the arena is now empty
+	Header = &((ARENA_HEADER*)Ptr)[-1];
+	if ((UINTN)Header + Header->Size == (UINTN)Arena.Base + Arena.Offset)
+		Arena.Offset -= Header->Size;
+	if (Arena.Outstanding == 0)
+		Arena.Offset = 0;
+}
+
+/*
+ * Mark the end of a boot phase. In debug builds, this reports the arena
+ * usage and any allocation that the phase failed to release.
+ */
+VOID ArenaCheckpoint(CONST CHAR16* Phase)
+{
+#if defined(_DEBUG)
+	PrintInfo(L"Arena [%s]: %d/%d bytes peak, %d outstanding, %d from pool", Phase,
+		Arena.Peak, Arena.Size, Arena.Outstanding, Arena.PoolAllocations);
+#endif
+	Arena.Peak = Arena.Offset;
+}
+
+/*
+ * Release the arena pages, so that whatever we chain load inherits
+ * the memory map as it was before we started.
+ */
+VOID ArenaRelease(VOID)
+{
+	if (Arena.Outstanding != 0)
+		PrintWarning(L"Arena: %d allocation(s) were not released", Arena.Outstanding);
+	// Don't pull the pages from under allocations that are still live
+	if ((Arena.Base != 0) && (Arena.Offset == 0)) {
+		gBS->FreePages(Arena.Base, ARENA_PAGES);
+		Arena.Base = 0;
+		Arena.Size = 0;
+	}
+}
@@ -0,0 +1,202 @@
+#!/bin/sh
+# uefi-ntfs: UEFI → NTFS/exFAT chain loader - Boot latency benchmark
+# Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+#
+# Builds a GPT disk with a FAT ESP, that contains UEFI:NTFS, and an NTFS or
+# exFAT partition, that contains a payload printing "Hello from NTFS/exFAT!",
+# then boots it headless in QEMU a number of times and reports percentiles
+# for the time it takes to reach the payload. The Boot Loader Interface
+# variables that the payload reports are checked with bli.sh on every boot.
+#
+# Everything is generated locally, so that this can run without network
+# access. It requires QEMU, a local UEFI firmware, util-linux (sfdisk),
+# dosfstools, mtools, ntfs-3g, exfatprogs and exfat-fuse.
+#
+# Usage: bench.sh ARCH QEMU FIRMWARE LOADER PAYLOAD NTFS_DRIVER EXFAT_DRIVER [RUNS] [TIMEOUT]
+# This is meant to be invoked through 'make bench'.
+
+set -e
+
+ARCH=$1
+QEMU=$2
+FIRMWARE=$3
+LOADER=$4
+PAYLOAD=$5
+NTFS_DRIVER=$6
+EXFAT_DRIVER=$7
+RUNS=${8:-10}
+TIMEOUT=${9:-60}
+MARKER="Hello from"
+WORK=bench/work-$ARCH
+BLI_GUID=4a67b082-0a4c-41cf-b6c7-440b29bb8c4f
+CR=$(printf '\r')
+
+# Size and start of the partitions, in MB
+DISK_SIZE=128
+ESP_START=1
+ESP_SIZE=32
+DATA_START=$((ESP_START + ESP_SIZE))
+DATA_SIZE=$((DISK_SIZE - DATA_START - 1))
+
+die() {
+	echo "bench: $*" >&2
+	exit 1
+}
+
+[ -f "$FIRMWARE" ] || die "firmware '$FIRMWARE' not found, set BENCH_FW to a UEFI firmware for $ARCH"
+for f in "$LOADER" "$PAYLOAD"; do
+	[ -f "$f" ] || die "'$f' not found"
+done
+command -v "${QEMU%% *}" >/dev/null || die "'${QEMU%% *}' not found"
+for t in sfdisk mkfs.fat mmd mcopy mkntfs ntfs-3g mkfs.exfat mount.exfat-fuse fusermount; do
+	command -v $t >/dev/null || die "'$t' not found"
+done
+
+rm -rf "$WORK"
+mkdir -p "$WORK/mnt"
+
+# Create the FAT ESP, with the drivers we have. UEFI:NTFS reads the payload
+# from exFAT directly, but still starts the exFAT driver for it, as it does
+# for any bootloader that isn't Windows bootmgr. Without the driver, it only
+# warns, so the exFAT partition is benchmarked either way.
+mkfs.fat -F 32 -C "$WORK/esp.img" $((ESP_SIZE * 1024)) >/dev/null
+mmd -i "$WORK/esp.img" ::/efi ::/efi/boot ::/efi/rufus
+mcopy -i "$WORK/esp.img" "$LOADER" ::/efi/boot/boot$ARCH.efi
+if [ -f "$NTFS_DRIVER" ]; then
+	mcopy -i "$WORK/esp.img" "$NTFS_DRIVER" ::/efi/rufus/ntfs_$ARCH.efi
+else
+	echo "bench: '$NTFS_DRIVER' not found, NTFS will not be benchmarked"
+fi
+if [ -f "$EXFAT_DRIVER" ]; then
+	mcopy -i "$WORK/esp.img" "$EXFAT_DRIVER" ::/efi/rufus/exfat_$ARCH.efi
+else
+	echo "bench: '$EXFAT_DRIVER' not found, exFAT will be benchmarked without its driver"
+fi
+
+# Create a data partition and copy the payload as the target bootloader
+make_data() {
+	truncate -s ${DATA_SIZE}M "$WORK/$1.img"
+	case $1 in
+	ntfs)
+		mkntfs -F -Q -q -L NTFS "$WORK/ntfs.img"
+		ntfs-3g "$WORK/ntfs.img" "$WORK/mnt"
+		;;
+	exfat)
+		mkfs.exfat -L EXFAT "$WORK/exfat.img" >/dev/null
+		mount.exfat-fuse "$WORK/exfat.img" "$WORK/mnt"
+		;;
+	esac
+	mkdir -p "$WORK/mnt/efi/boot"
+	cp "$PAYLOAD" "$WORK/mnt/efi/boot/boot$ARCH.efi"
+	fusermount -u "$WORK/mnt"
+}
+
+# Assemble the ESP and data partition into a GPT disk
+make_disk() {
+	truncate -s ${DISK_SIZE}M "$WORK/$1.disk"
+	sfdisk -q "$WORK/$1.disk" <<-EOF
+	label: gpt
+	start=${ESP_START}MiB, size=${ESP_SIZE}MiB, type=C12A7328-F81F-11D2-BA4B-00A0C93EC93B
+	start=${DATA_START}MiB, size=${DATA_SIZE}MiB, type=EBD0A0A2-B9E5-4433-87C0-68B6B72699C7
+	EOF
+	dd if="$WORK/esp.img" of="$WORK/$1.disk" bs=1M seek=$ESP_START conv=notrunc status=none
+	dd if="$WORK/$1.img" of="$WORK/$1.disk" bs=1M seek=$DATA_START conv=notrunc status=none
+}
+
+# Boot the disk once and print the number of milliseconds it took to reach
+# the payload, or nothing if it didn't within TIMEOUT seconds. The "BLI"
+# lines that the payload prints next are saved to $WORK/$1.bli.
+boot_once() {
+	start=$(date +%s%N)
+	: > "$WORK/$1.bli"
+	timeout $TIMEOUT $QEMU -bios "$FIRMWARE" -net none -nographic \
+		-drive file="$WORK/$1.disk",format=raw </dev/null 2>&1 | \
+	while IFS= read -r line; do
+		line=${line%"$CR"}
+		case "$line" in
+		*"$MARKER"*)
+			echo $((($(date +%s%N) - start) / 1000000))
+			;;
+		*"BLI end"*)
+			break
+			;;
+		*"BLI "*)
+			echo "BLI ${line#*BLI }" >> "$WORK/$1.bli"
+			;;
+		esac
+	done
+}
+
+# Print the bytes that a hex string stands for
+unhex() {
+	hex=$1
+	while [ -n "$hex" ]; do
+		rest=${hex#??}
+		printf "\\$(printf %03o 0x${hex%"$rest"})"
+		hex=$rest
+	done
+}
+
+# Turn the variables saved by boot_once into efivarfs files, which start
+# with the attributes as a little endian 32-bit value, and check them with
+# bli.sh. Returns 2 if the variables were not set at all.
+check_bli() {
+	rm -rf "$WORK/$1.efivars"
+	mkdir -p "$WORK/$1.efivars"
+	grep -q "^BLI LoaderInfo " "$WORK/$1.bli" || return 2
+	while read -r tag name attributes data; do
+		{
+			unhex "$(echo $attributes | sed 's/\(..\)\(..\)\(..\)\(..\)/\4\3\2\1/')"
+			unhex "$data"
+		} > "$WORK/$1.efivars/$name-$BLI_GUID"
+	done < "$WORK/$1.bli"
+	sh "$(dirname "$0")/bli.sh" "$WORK/$1.efivars" >/dev/null
+}
+
+# Print the nearest-rank percentiles for a list of values
+percentiles() {
+	sort -n "$1" | awk '{ v[NR] = $1 } END {
+		if (NR == 0) { print "no successful boot"; exit }
+		split("50 90 99", p, " ")
+		printf "min %d ms", v[1]
+		for (i = 1; i <= 3; i++) {
+			r = int((p[i] * NR + 99) / 100)
+			printf ", p%d %d ms", p[i], v[r]
+		}
+		printf ", max %d ms (%d boots)\n", v[NR], NR
+	}'
+}
+
+status=0
+for fs in ntfs exfat; do
+	[ $fs = ntfs ] && [ ! -f "$NTFS_DRIVER" ] && continue
+	make_data $fs
+	make_disk $fs
+	: > "$WORK/$fs.txt"
+	failed=0
+	invalid=0
+	unset=0
+	i=0
+	while [ $i -lt $RUNS ]; do
+		ms=$(boot_once $fs)
+		if [ -n "$ms" ]; then
+			echo $ms >> "$WORK/$fs.txt"
+			check_bli $fs || case $? in
+				2) unset=$((unset + 1)) ;;
+				*) invalid=$((invalid + 1)) ;;
+			esac
+		else
+			failed=$((failed + 1))
+		fi
+		i=$((i + 1))
+	done
+	printf "%s %s: " $ARCH $fs
+	percentiles "$WORK/$fs.txt"
+	[ $failed -eq 0 ] || echo "$ARCH $fs: $failed boot(s) did not reach the payload"
+	[ $unset -eq 0 ] || echo "$ARCH $fs: $unset boot(s) without Boot Loader Interface variables (expected with LEAN=1)"
+	if [ $invalid -ne 0 ]; then
+		echo "$ARCH $fs: $invalid boot(s) with invalid Boot Loader Interface variables"
+		status=1
+	fi
+done
+exit $status
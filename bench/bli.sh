@@ -0,0 +1,64 @@
+#!/bin/sh
+# uefi-ntfs: UEFI → NTFS/exFAT chain loader - Boot Loader Interface decoder
+# Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+#
+# Decodes and validates the Boot Loader Interface variables that UEFI:NTFS
+# sets, from a Linux system that was booted through it, and prints the time
+# spent in UEFI:NTFS, as 'systemd-analyze' would account for it.
+# The variables are read from efivarfs, or from a directory holding copies
+# of the efivarfs files, so that captures from other machines can be checked.
+#
+# Usage: bli.sh [EFIVARS_DIR]
+
+EFIVARS=${1:-/sys/firmware/efi/efivars}
+GUID=4a67b082-0a4c-41cf-b6c7-440b29bb8c4f
+failed=0
+
+die() {
+	echo "bli: $*" >&2
+	exit 1
+}
+
+fail() {
+	echo "bli: $*" >&2
+	failed=1
+}
+
+# Print a variable's value. efivarfs files start with the 32-bit attributes,
+# followed by the data, which is a NUL terminated UTF-16LE string here.
+read_var() {
+	f="$EFIVARS/$1-$GUID"
+	[ -f "$f" ] || return 1
+	tail -c +5 "$f" | iconv -f UTF-16LE -t UTF-8 | tr -d '\000'
+}
+
+[ -d "$EFIVARS" ] || die "'$EFIVARS' not found"
+command -v iconv >/dev/null || die "'iconv' not found"
+
+info=$(read_var LoaderInfo) || die "LoaderInfo is not set"
+printf "LoaderInfo:            %s\n" "$info"
+case "$info" in
+"UEFI:NTFS "*) ;;
+*) fail "LoaderInfo was not set by UEFI:NTFS" ;;
+esac
+
+uuid=$(read_var LoaderDevicePartUUID) && printf "LoaderDevicePartUUID:  %s\n" "$uuid"
+echo "$uuid" | grep -qE '^[0-9a-f]{8}-([0-9a-f]{4}-){3}[0-9a-f]{12}$' || \
+	fail "LoaderDevicePartUUID is missing or malformed"
+
+image=$(read_var LoaderImageIdentifier) && printf "LoaderImageIdentifier: %s\n" "$image"
+case "$image" in
+\\*) ;;
+*) fail "LoaderImageIdentifier is missing or not an absolute path" ;;
+esac
+
+init=$(read_var LoaderTimeInitUSec) && printf "LoaderTimeInitUSec:    %s\n" "$init"
+exec=$(read_var LoaderTimeExecUSec) && printf "LoaderTimeExecUSec:    %s\n" "$exec"
+if echo "$init" | grep -qE '^[0-9]+$' && echo "$exec" | grep -qE '^[0-9]+$'; then
+	[ "$exec" -ge "$init" ] || fail "LoaderTimeExecUSec is earlier than LoaderTimeInitUSec"
+	echo "Firmware: $((init / 1000)) ms, UEFI:NTFS: $(((exec - init) / 1000)) ms"
+else
+	fail "the loader times are missing or not decimal numbers"
+fi
+
+exit $failed
@@ -0,0 +1,63 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Benchmark payload
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+/* The Boot Loader Interface variables that bli.c sets */
+STATIC EFI_GUID LoaderInterfaceGuid =
+	{ 0x4a67b082, 0x0a4c, 0x41cf, { 0xb6, 0xc7, 0x44, 0x0b, 0x29, 0xbb, 0x8c, 0x4f } };
+STATIC CHAR16* LoaderVariables[] = { L"LoaderInfo", L"LoaderDevicePartUUID",
+	L"LoaderImageIdentifier", L"LoaderTimeInitUSec", L"LoaderTimeExecUSec" };
+
+/*
+ * Print the Boot Loader Interface variables that we were started with, as
+ * "BLI <name> <attributes> <data>" lines in hex, followed by "BLI end", so
+ * that bench.sh can check them with bli.sh.
+ */
+STATIC VOID DumpLoaderVariables(VOID)
+{
+	UINT8 Data[256];
+	UINT32 Attributes;
+	UINTN i, j, Size;
+
+	for (i = 0; i < sizeof(LoaderVariables) / sizeof(LoaderVariables[0]); i++) {
+		Size = sizeof(Data);
+		if (gRT->GetVariable(LoaderVariables[i], &LoaderInterfaceGuid, &Attributes, &Size, Data) != EFI_SUCCESS)
+			continue;
+		Print(L"BLI %s %08x ", LoaderVariables[i], Attributes);
+		for (j = 0; j < Size; j++)
+			Print(L"%02x", Data[j]);
+		Print(L"\n");
+	}
+	Print(L"BLI end\n");
+}
+
+/*
+ * Minimal payload for the bench target, that gets chain loaded from the
+ * NTFS or exFAT partition, announces itself, reports the Boot Loader
+ * Interface variables it got and powers the VM off.
+ */
+EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
+{
+	InitializeLib(ImageHandle, SystemTable);
+	Print(L"Hello from NTFS/exFAT!\n");
+	DumpLoaderVariables();
+	gRT->ResetSystem(EfiResetShutdown, EFI_SUCCESS, 0, NULL);
+	return EFI_SUCCESS;
+}
@@ -0,0 +1,260 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Host build UEFI types
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The subset of the gnu-efi types and protocols that the parsers use, so that
+ * they can be compiled and exercised on the build host, with -fshort-wchar.
+ * See host.c for the library calls and the boot services we emulate.
+ */
+#ifndef HOST_EFI_H
+#define HOST_EFI_H
+#include <stdint.h>
+#include <stddef.h>
+#define _GNU_EFI
+typedef uint8_t UINT8; typedef uint16_t UINT16; typedef uint32_t UINT32; typedef uint64_t UINT64;
+typedef int8_t INT8; typedef int16_t INT16; typedef int32_t INT32; typedef int64_t INT64;
+typedef intptr_t INTN; typedef uintptr_t UINTN; typedef char CHAR8; typedef uint16_t CHAR16;
+typedef uint8_t BOOLEAN; typedef void VOID;
+#define CONST const
+#define STATIC static
+#define IN
+#define OUT
+#define OPTIONAL
+#define EFIAPI
+#define TRUE 1
+#define FALSE 0
+typedef UINTN EFI_STATUS; typedef VOID* EFI_HANDLE; typedef VOID* EFI_EVENT; typedef UINT64 EFI_LBA;
+typedef UINT64 EFI_PHYSICAL_ADDRESS; typedef UINTN EFI_TPL;
+typedef struct { UINT32 Data1; UINT16 Data2; UINT16 Data3; UINT8 Data4[8]; } EFI_GUID;
+#define EFIERR(a) ((UINTN)1 << (sizeof(UINTN)*8-1) | (a))
+#define EFI_ERROR(a) (((INTN)(a)) < 0)
+#define EFI_SUCCESS 0
+#define EFI_LOAD_ERROR EFIERR(1)
+#define EFI_INVALID_PARAMETER EFIERR(2)
+#define EFI_UNSUPPORTED EFIERR(3)
+#define EFI_BAD_BUFFER_SIZE EFIERR(4)
+#define EFI_BUFFER_TOO_SMALL EFIERR(5)
+#define EFI_NOT_READY EFIERR(6)
+#define EFI_DEVICE_ERROR EFIERR(7)
+#define EFI_WRITE_PROTECTED EFIERR(8)
+#define EFI_OUT_OF_RESOURCES EFIERR(9)
+#define EFI_VOLUME_CORRUPTED EFIERR(10)
+#define EFI_VOLUME_FULL EFIERR(11)
+#define EFI_NO_MEDIA EFIERR(12)
+#define EFI_MEDIA_CHANGED EFIERR(13)
+#define EFI_NOT_FOUND EFIERR(14)
+#define EFI_ACCESS_DENIED EFIERR(15)
+#define EFI_NO_MAPPING EFIERR(17)
+#define EFI_TIMEOUT EFIERR(18)
+#define EFI_NOT_STARTED EFIERR(19)
+#define EFI_ALREADY_STARTED EFIERR(20)
+#define EFI_ABORTED EFIERR(21)
+#define EFI_INCOMPATIBLE_VERSION EFIERR(25)
+#define EFI_SECURITY_VIOLATION EFIERR(26)
+#define EFI_END_OF_FILE EFIERR(31)
+
+#define EFI_BLACK 0x00
+#define EFI_LIGHTGRAY 0x07
+#define EFI_YELLOW 0x0E
+#define EFI_LIGHTRED 0x0C
+#define EFI_LIGHTGREEN 0x0A
+#define EFI_WHITE 0x0F
+#define EFI_TEXT_ATTR(f,b) ((f) | ((b) << 4))
+#define BOXDRAW_HORIZONTAL 0x2500
+#define BOXDRAW_VERTICAL 0x2502
+#define BOXDRAW_DOWN_RIGHT 0x250c
+#define BOXDRAW_DOWN_LEFT 0x2510
+#define BOXDRAW_UP_RIGHT 0x2514
+#define BOXDRAW_UP_LEFT 0x2518
+
+typedef struct { UINT64 Signature; UINT32 Revision; UINT32 HeaderSize; UINT32 CRC32; UINT32 Reserved; } EFI_TABLE_HEADER;
+typedef struct { UINT16 Year; UINT8 Month, Day, Hour, Minute, Second, Pad1; UINT32 Nanosecond; INT16 TimeZone; UINT8 Daylight, Pad2; } EFI_TIME;
+
+typedef struct _EFI_DEVICE_PATH { UINT8 Type; UINT8 SubType; UINT8 Length[2]; } EFI_DEVICE_PATH, EFI_DEVICE_PATH_PROTOCOL;
+#define END_DEVICE_PATH_TYPE 0x7f
+#define END_ENTIRE_DEVICE_PATH_SUBTYPE 0xff
+#define MEDIA_DEVICE_PATH 0x04
+#define MEDIA_HARDDRIVE_DP 0x01
+#define MEDIA_FILEPATH_DP 0x04
+#define SIGNATURE_TYPE_GUID 0x02
+typedef struct { EFI_DEVICE_PATH Header; UINT32 PartitionNumber; UINT64 PartitionStart; UINT64 PartitionSize; UINT8 Signature[16]; UINT8 MBRType; UINT8 SignatureType; } __attribute__((packed)) HARDDRIVE_DEVICE_PATH;
+typedef struct { EFI_DEVICE_PATH Header; CHAR16 PathName[1]; } __attribute__((packed)) FILEPATH_DEVICE_PATH;
+#define DevicePathType(a) ((a)->Type & 0x7f)
+#define DevicePathSubType(a) ((a)->SubType)
+#define DevicePathNodeLength(a) ((UINTN)((a)->Length[0] | ((a)->Length[1] << 8)))
+#define NextDevicePathNode(a) ((EFI_DEVICE_PATH*)(((UINT8*)(a)) + DevicePathNodeLength(a)))
+#define IsDevicePathEnd(a) (DevicePathType(a) == END_DEVICE_PATH_TYPE && (a)->SubType == END_ENTIRE_DEVICE_PATH_SUBTYPE)
+#define SetDevicePathNodeLength(a,l) do { (a)->Length[0] = (UINT8)(l); (a)->Length[1] = (UINT8)((l) >> 8); } while (0)
+
+typedef struct { UINT16 ScanCode; CHAR16 UnicodeChar; } EFI_INPUT_KEY;
+typedef struct _SIMPLE_INPUT { EFI_STATUS (EFIAPI *Reset)(struct _SIMPLE_INPUT*, BOOLEAN); EFI_STATUS (EFIAPI *ReadKeyStroke)(struct _SIMPLE_INPUT*, EFI_INPUT_KEY*); EFI_EVENT WaitForKey; } SIMPLE_INPUT_INTERFACE, EFI_SIMPLE_TEXT_INPUT_PROTOCOL;
+typedef struct _SIMPLE_TEXT_OUTPUT { VOID* Reset; VOID* OutputString; VOID* TestString; VOID* QueryMode; VOID* SetMode; EFI_STATUS (EFIAPI *SetAttribute)(struct _SIMPLE_TEXT_OUTPUT*, UINTN); EFI_STATUS (EFIAPI *ClearScreen)(struct _SIMPLE_TEXT_OUTPUT*); } SIMPLE_TEXT_OUTPUT_INTERFACE;
+
+typedef enum { AllHandles, ByRegisterNotify, ByProtocol } EFI_LOCATE_SEARCH_TYPE;
+typedef enum { AllocateAnyPages, AllocateMaxAddress, AllocateAddress } EFI_ALLOCATE_TYPE;
+typedef enum { EfiReservedMemoryType, EfiLoaderCode, EfiLoaderData, EfiBootServicesCode, EfiBootServicesData, EfiRuntimeServicesCode, EfiRuntimeServicesData } EFI_MEMORY_TYPE;
+typedef enum { TimerCancel, TimerPeriodic, TimerRelative } EFI_TIMER_DELAY;
+typedef enum { EfiResetCold, EfiResetWarm, EfiResetShutdown } EFI_RESET_TYPE;
+typedef struct { EFI_HANDLE AgentHandle; EFI_HANDLE ControllerHandle; UINT32 Attributes; UINT32 OpenCount; } EFI_OPEN_PROTOCOL_INFORMATION_ENTRY;
+#define EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL 0x01
+#define EFI_OPEN_PROTOCOL_GET_PROTOCOL 0x02
+#define EFI_OPEN_PROTOCOL_TEST_PROTOCOL 0x04
+#define EFI_OPEN_PROTOCOL_BY_CHILD_CONTROLLER 0x08
+#define EFI_OPEN_PROTOCOL_BY_DRIVER 0x10
+#define EFI_OPEN_PROTOCOL_EXCLUSIVE 0x20
+#define EVT_TIMER 0x80000000
+#define EVT_RUNTIME 0x40000000
+#define EVT_NOTIFY_WAIT 0x00000100
+#define EVT_NOTIFY_SIGNAL 0x00000200
+#define EVT_SIGNAL_EXIT_BOOT_SERVICES 0x00000201
+#define TPL_APPLICATION 4
+#define TPL_CALLBACK 8
+#define TPL_NOTIFY 16
+#define EFI_PAGE_SIZE 4096
+#define EFI_SIZE_TO_PAGES(s) (((s) >> 12) + (((s) & 0xfff) ? 1 : 0))
+#define EFI_PAGES_TO_SIZE(p) ((UINTN)(p) << 12)
+typedef VOID (EFIAPI *EFI_EVENT_NOTIFY)(EFI_EVENT, VOID*);
+typedef enum { EFI_NATIVE_INTERFACE } EFI_INTERFACE_TYPE;
+
+typedef struct {
+	EFI_TABLE_HEADER Hdr;
+	EFI_TPL (EFIAPI *RaiseTPL)(EFI_TPL);
+	VOID (EFIAPI *RestoreTPL)(EFI_TPL);
+	EFI_STATUS (EFIAPI *AllocatePages)(EFI_ALLOCATE_TYPE, EFI_MEMORY_TYPE, UINTN, EFI_PHYSICAL_ADDRESS*);
+	EFI_STATUS (EFIAPI *FreePages)(EFI_PHYSICAL_ADDRESS, UINTN);
+	VOID* GetMemoryMap;
+	EFI_STATUS (EFIAPI *AllocatePool)(EFI_MEMORY_TYPE, UINTN, VOID**);
+	EFI_STATUS (EFIAPI *FreePool)(VOID*);
+	EFI_STATUS (EFIAPI *CreateEvent)(UINT32, EFI_TPL, EFI_EVENT_NOTIFY, VOID*, EFI_EVENT*);
+	EFI_STATUS (EFIAPI *SetTimer)(EFI_EVENT, EFI_TIMER_DELAY, UINT64);
+	EFI_STATUS (EFIAPI *WaitForEvent)(UINTN, EFI_EVENT*, UINTN*);
+	EFI_STATUS (EFIAPI *SignalEvent)(EFI_EVENT);
+	EFI_STATUS (EFIAPI *CloseEvent)(EFI_EVENT);
+	EFI_STATUS (EFIAPI *CheckEvent)(EFI_EVENT);
+	EFI_STATUS (EFIAPI *InstallProtocolInterface)(EFI_HANDLE*, EFI_GUID*, EFI_INTERFACE_TYPE, VOID*);
+	EFI_STATUS (EFIAPI *ReinstallProtocolInterface)(EFI_HANDLE, EFI_GUID*, VOID*, VOID*);
+	EFI_STATUS (EFIAPI *UninstallProtocolInterface)(EFI_HANDLE, EFI_GUID*, VOID*);
+	EFI_STATUS (EFIAPI *HandleProtocol)(EFI_HANDLE, EFI_GUID*, VOID**);
+	VOID* Reserved;
+	EFI_STATUS (EFIAPI *RegisterProtocolNotify)(EFI_GUID*, EFI_EVENT, VOID**);
+	EFI_STATUS (EFIAPI *LocateHandle)(EFI_LOCATE_SEARCH_TYPE, EFI_GUID*, VOID*, UINTN*, EFI_HANDLE*);
+	EFI_STATUS (EFIAPI *LocateDevicePath)(EFI_GUID*, EFI_DEVICE_PATH**, EFI_HANDLE*);
+	VOID* InstallConfigurationTable;
+	EFI_STATUS (EFIAPI *LoadImage)(BOOLEAN, EFI_HANDLE, EFI_DEVICE_PATH*, VOID*, UINTN, EFI_HANDLE*);
+	EFI_STATUS (EFIAPI *StartImage)(EFI_HANDLE, UINTN*, CHAR16**);
+	EFI_STATUS (EFIAPI *Exit)(EFI_HANDLE, EFI_STATUS, UINTN, CHAR16*);
+	EFI_STATUS (EFIAPI *UnloadImage)(EFI_HANDLE);
+	VOID* ExitBootServices;
+	EFI_STATUS (EFIAPI *GetNextMonotonicCount)(UINT64*);
+	EFI_STATUS (EFIAPI *Stall)(UINTN);
+	EFI_STATUS (EFIAPI *SetWatchdogTimer)(UINTN, UINT64, UINTN, CHAR16*);
+	EFI_STATUS (EFIAPI *ConnectController)(EFI_HANDLE, EFI_HANDLE*, EFI_DEVICE_PATH*, BOOLEAN);
+	EFI_STATUS (EFIAPI *DisconnectController)(EFI_HANDLE, EFI_HANDLE, EFI_HANDLE);
+	EFI_STATUS (EFIAPI *OpenProtocol)(EFI_HANDLE, EFI_GUID*, VOID**, EFI_HANDLE, EFI_HANDLE, UINT32);
+	EFI_STATUS (EFIAPI *CloseProtocol)(EFI_HANDLE, EFI_GUID*, EFI_HANDLE, EFI_HANDLE);
+	EFI_STATUS (EFIAPI *OpenProtocolInformation)(EFI_HANDLE, EFI_GUID*, EFI_OPEN_PROTOCOL_INFORMATION_ENTRY**, UINTN*);
+	EFI_STATUS (EFIAPI *ProtocolsPerHandle)(EFI_HANDLE, EFI_GUID***, UINTN*);
+	EFI_STATUS (EFIAPI *LocateHandleBuffer)(EFI_LOCATE_SEARCH_TYPE, EFI_GUID*, VOID*, UINTN*, EFI_HANDLE**);
+	EFI_STATUS (EFIAPI *LocateProtocol)(EFI_GUID*, VOID*, VOID**);
+	EFI_STATUS (EFIAPI *InstallMultipleProtocolInterfaces)(EFI_HANDLE*, ...);
+	EFI_STATUS (EFIAPI *UninstallMultipleProtocolInterfaces)(EFI_HANDLE, ...);
+	VOID* CalculateCrc32;
+	VOID (EFIAPI *CopyMem)(VOID*, VOID*, UINTN);
+	VOID (EFIAPI *SetMem)(VOID*, UINTN, UINT8);
+} EFI_BOOT_SERVICES;
+
+typedef struct {
+	EFI_TABLE_HEADER Hdr;
+	EFI_STATUS (EFIAPI *GetTime)(EFI_TIME*, VOID*);
+	VOID *SetTime, *GetWakeupTime, *SetWakeupTime, *SetVirtualAddressMap, *ConvertPointer;
+	EFI_STATUS (EFIAPI *GetVariable)(CHAR16*, EFI_GUID*, UINT32*, UINTN*, VOID*);
+	EFI_STATUS (EFIAPI *GetNextVariableName)(UINTN*, CHAR16*, EFI_GUID*);
+	EFI_STATUS (EFIAPI *SetVariable)(CHAR16*, EFI_GUID*, UINT32, UINTN, VOID*);
+	VOID* GetNextHighMonotonicCount;
+	VOID (EFIAPI *ResetSystem)(EFI_RESET_TYPE, EFI_STATUS, UINTN, VOID*);
+} EFI_RUNTIME_SERVICES;
+#define EFI_VARIABLE_NON_VOLATILE 0x1
+#define EFI_VARIABLE_BOOTSERVICE_ACCESS 0x2
+#define EFI_VARIABLE_RUNTIME_ACCESS 0x4
+
+typedef struct { EFI_GUID VendorGuid; VOID* VendorTable; } EFI_CONFIGURATION_TABLE;
+typedef struct {
+	EFI_TABLE_HEADER Hdr; CHAR16* FirmwareVendor; UINT32 FirmwareRevision;
+	EFI_HANDLE ConsoleInHandle; SIMPLE_INPUT_INTERFACE* ConIn; EFI_HANDLE ConsoleOutHandle; SIMPLE_TEXT_OUTPUT_INTERFACE* ConOut;
+	EFI_HANDLE StandardErrorHandle; SIMPLE_TEXT_OUTPUT_INTERFACE* StdErr;
+	EFI_RUNTIME_SERVICES* RuntimeServices; EFI_BOOT_SERVICES* BootServices;
+	UINTN NumberOfTableEntries; EFI_CONFIGURATION_TABLE* ConfigurationTable;
+} EFI_SYSTEM_TABLE;
+
+typedef struct { UINT32 MediaId; BOOLEAN RemovableMedia, MediaPresent, LogicalPartition, ReadOnly, WriteCaching; UINT32 BlockSize; UINT32 IoAlign; EFI_LBA LastBlock; EFI_LBA LowestAlignedLba; UINT32 LogicalBlocksPerPhysicalBlock; UINT32 OptimalTransferLengthGranularity; } EFI_BLOCK_IO_MEDIA;
+typedef struct _EFI_BLOCK_IO { UINT64 Revision; EFI_BLOCK_IO_MEDIA* Media;
+	EFI_STATUS (EFIAPI *Reset)(struct _EFI_BLOCK_IO*, BOOLEAN);
+	EFI_STATUS (EFIAPI *ReadBlocks)(struct _EFI_BLOCK_IO*, UINT32, EFI_LBA, UINTN, VOID*);
+	EFI_STATUS (EFIAPI *WriteBlocks)(struct _EFI_BLOCK_IO*, UINT32, EFI_LBA, UINTN, VOID*);
+	EFI_STATUS (EFIAPI *FlushBlocks)(struct _EFI_BLOCK_IO*); } EFI_BLOCK_IO, EFI_BLOCK_IO_PROTOCOL;
+typedef struct _EFI_DISK_IO { UINT64 Revision;
+	EFI_STATUS (EFIAPI *ReadDisk)(struct _EFI_DISK_IO*, UINT32, UINT64, UINTN, VOID*);
+	EFI_STATUS (EFIAPI *WriteDisk)(struct _EFI_DISK_IO*, UINT32, UINT64, UINTN, VOID*); } EFI_DISK_IO, EFI_DISK_IO_PROTOCOL;
+#define EFI_DISK_IO_PROTOCOL_REVISION 0x00010000
+
+typedef struct { EFI_EVENT Event; EFI_STATUS TransactionStatus; } EFI_DISK_IO2_TOKEN;
+
+typedef struct { UINT64 Size, FileSize, PhysicalSize; EFI_TIME CreateTime, LastAccessTime, ModificationTime; UINT64 Attribute; CHAR16 FileName[1]; } EFI_FILE_INFO;
+#define EFI_FILE_DIRECTORY 0x10
+typedef struct { CHAR16 VolumeLabel[1]; } EFI_FILE_SYSTEM_VOLUME_LABEL;
+typedef struct { UINT64 Size; BOOLEAN ReadOnly; UINT64 VolumeSize, FreeSpace; UINT32 BlockSize; CHAR16 VolumeLabel[1]; } EFI_FILE_SYSTEM_INFO;
+typedef struct { EFI_EVENT Event; EFI_STATUS Status; UINTN BufferSize; VOID* Buffer; } EFI_FILE_IO_TOKEN;
+typedef struct _EFI_FILE_HANDLE { UINT64 Revision;
+	EFI_STATUS (EFIAPI *Open)(struct _EFI_FILE_HANDLE*, struct _EFI_FILE_HANDLE**, CHAR16*, UINT64, UINT64);
+	EFI_STATUS (EFIAPI *Close)(struct _EFI_FILE_HANDLE*);
+	EFI_STATUS (EFIAPI *Delete)(struct _EFI_FILE_HANDLE*);
+	EFI_STATUS (EFIAPI *Read)(struct _EFI_FILE_HANDLE*, UINTN*, VOID*);
+	EFI_STATUS (EFIAPI *Write)(struct _EFI_FILE_HANDLE*, UINTN*, VOID*);
+	EFI_STATUS (EFIAPI *GetPosition)(struct _EFI_FILE_HANDLE*, UINT64*);
+	EFI_STATUS (EFIAPI *SetPosition)(struct _EFI_FILE_HANDLE*, UINT64);
+	EFI_STATUS (EFIAPI *GetInfo)(struct _EFI_FILE_HANDLE*, EFI_GUID*, UINTN*, VOID*);
+	EFI_STATUS (EFIAPI *SetInfo)(struct _EFI_FILE_HANDLE*, EFI_GUID*, UINTN, VOID*);
+	EFI_STATUS (EFIAPI *Flush)(struct _EFI_FILE_HANDLE*);
+	EFI_STATUS (EFIAPI *OpenEx)(struct _EFI_FILE_HANDLE*, struct _EFI_FILE_HANDLE**, CHAR16*, UINT64, UINT64, EFI_FILE_IO_TOKEN*);
+	EFI_STATUS (EFIAPI *ReadEx)(struct _EFI_FILE_HANDLE*, EFI_FILE_IO_TOKEN*);
+	EFI_STATUS (EFIAPI *WriteEx)(struct _EFI_FILE_HANDLE*, EFI_FILE_IO_TOKEN*);
+	EFI_STATUS (EFIAPI *FlushEx)(struct _EFI_FILE_HANDLE*, EFI_FILE_IO_TOKEN*);
+} EFI_FILE, EFI_FILE_PROTOCOL, *EFI_FILE_HANDLE;
+#define EFI_FILE_PROTOCOL_REVISION2 0x00020000
+#define EFI_FILE_MODE_READ 0x1ULL
+#define EFI_FILE_MODE_WRITE 0x2ULL
+#define EFI_FILE_MODE_CREATE 0x8000000000000000ULL
+typedef struct _EFI_SIMPLE_FILE_SYSTEM_PROTOCOL { UINT64 Revision; EFI_STATUS (EFIAPI *OpenVolume)(struct _EFI_SIMPLE_FILE_SYSTEM_PROTOCOL*, EFI_FILE_HANDLE*); } EFI_SIMPLE_FILE_SYSTEM_PROTOCOL, EFI_FILE_IO_INTERFACE;
+
+typedef struct { UINT32 Revision; EFI_HANDLE ParentHandle; EFI_SYSTEM_TABLE* SystemTable; EFI_HANDLE DeviceHandle; EFI_DEVICE_PATH* FilePath; VOID* Reserved; UINT32 LoadOptionsSize; VOID* LoadOptions; VOID* ImageBase; UINT64 ImageSize; EFI_MEMORY_TYPE ImageCodeType; EFI_MEMORY_TYPE ImageDataType; VOID* Unload; } EFI_LOADED_IMAGE, EFI_LOADED_IMAGE_PROTOCOL;
+
+typedef struct { CHAR16* (EFIAPI *ConvertDeviceNodeToText)(CONST EFI_DEVICE_PATH*, BOOLEAN, BOOLEAN); CHAR16* (EFIAPI *ConvertDevicePathToText)(CONST EFI_DEVICE_PATH*, BOOLEAN, BOOLEAN); } EFI_DEVICE_PATH_TO_TEXT_PROTOCOL;
+typedef struct _EFI_COMPONENT_NAME2_PROTOCOL { EFI_STATUS (EFIAPI *GetDriverName)(struct _EFI_COMPONENT_NAME2_PROTOCOL*, CHAR8*, CHAR16**); VOID* GetControllerName; CHAR8* SupportedLanguages; } EFI_COMPONENT_NAME2_PROTOCOL;
+typedef struct _EFI_COMPONENT_NAME_PROTOCOL { EFI_STATUS (EFIAPI *GetDriverName)(struct _EFI_COMPONENT_NAME_PROTOCOL*, CHAR8*, CHAR16**); VOID* GetControllerName; CHAR8* SupportedLanguages; } EFI_COMPONENT_NAME_PROTOCOL;
+typedef struct _EFI_DRIVER_BINDING_PROTOCOL {
+	EFI_STATUS (EFIAPI *Supported)(struct _EFI_DRIVER_BINDING_PROTOCOL*, EFI_HANDLE, EFI_DEVICE_PATH*);
+	EFI_STATUS (EFIAPI *Start)(struct _EFI_DRIVER_BINDING_PROTOCOL*, EFI_HANDLE, EFI_DEVICE_PATH*);
+	EFI_STATUS (EFIAPI *Stop)(struct _EFI_DRIVER_BINDING_PROTOCOL*, EFI_HANDLE, UINTN, EFI_HANDLE*);
+	UINT32 Version; EFI_HANDLE ImageHandle; EFI_HANDLE DriverBindingHandle; } EFI_DRIVER_BINDING_PROTOCOL;
+
+extern EFI_GUID gEfiDiskIoProtocolGuid, gEfiDiskIo2ProtocolGuid, gEfiBlockIoProtocolGuid, gEfiBlockIo2ProtocolGuid, gEfiSimpleFileSystemProtocolGuid,
+	gEfiLoadedImageProtocolGuid, gEfiDevicePathProtocolGuid, gEfiDevicePathToTextProtocolGuid, gEfiComponentNameProtocolGuid,
+	gEfiComponentName2ProtocolGuid, gEfiDriverBindingProtocolGuid, gEfiFileInfoGuid, gEfiFileSystemInfoGuid,
+	gEfiFileSystemVolumeLabelInfoIdGuid, gEfiSmbiosTableGuid, gEfiSmbios3TableGuid, gEfiGlobalVariableGuid,
+	gEfiEventExitBootServicesGuid, gEfiLoadedImageDevicePathProtocolGuid;
+#endif
@@ -0,0 +1,51 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Host build UEFI library
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_EFILIB_H
+#define HOST_EFILIB_H
+
+#include <efi.h>
+extern EFI_SYSTEM_TABLE *gST, *ST; extern EFI_BOOT_SERVICES *gBS, *BS; extern EFI_RUNTIME_SERVICES *gRT, *RT;
+VOID InitializeLib(EFI_HANDLE, EFI_SYSTEM_TABLE*);
+UINTN Print(CONST CHAR16*, ...);
+UINTN UnicodeSPrint(CHAR16*, UINTN, CONST CHAR16*, ...);
+UINTN AsciiSPrint(CHAR8*, UINTN, CONST CHAR8*, ...);
+UINTN StrLen(CONST CHAR16*); INTN StrCmp(CONST CHAR16*, CONST CHAR16*); UINTN StrSize(CONST CHAR16*);
+UINTN AsciiStrLen(CONST CHAR8*);
+INTN CompareMem(CONST VOID*, CONST VOID*, UINTN); VOID ZeroMem(VOID*, UINTN); VOID CopyMem(VOID*, CONST VOID*, UINTN); VOID SetMem(VOID*, UINTN, UINT8);
+BOOLEAN CompareGuid(CONST EFI_GUID*, CONST EFI_GUID*);
+VOID* AllocatePool(UINTN); VOID* AllocateZeroPool(UINTN); VOID FreePool(VOID*); VOID* ReallocatePool(VOID*, UINTN, UINTN);
+EFI_DEVICE_PATH* DevicePathFromHandle(EFI_HANDLE); EFI_DEVICE_PATH* FileDevicePath(EFI_HANDLE, CONST CHAR16*);
+EFI_DEVICE_PATH* DuplicateDevicePath(EFI_DEVICE_PATH*); UINTN DevicePathSize(CONST EFI_DEVICE_PATH*);
+EFI_DEVICE_PATH* AppendDevicePath(CONST EFI_DEVICE_PATH*, CONST EFI_DEVICE_PATH*);
+CHAR16* DevicePathToStr(EFI_DEVICE_PATH*);
+UINT64 StrDecimalToUintn(CONST CHAR16*); UINTN StrHexToUintn(CONST CHAR16*);
+UINT64 DivU64x32(UINT64, UINTN, UINTN*); UINT64 MultU64x32(UINT64, UINTN);
+#include <efistdarg.h>
+UINTN UnicodeVSPrint(CHAR16*, UINTN, CONST CHAR16*, VA_LIST);
+INTN StrnCmp(CONST CHAR16*, CONST CHAR16*, UINTN);
+typedef EFI_STATUS (EFIAPI *EFI_BLOCK_READ)(EFI_BLOCK_IO_PROTOCOL*, UINT32, EFI_LBA, UINTN, VOID*);
+typedef EFI_STATUS (EFIAPI *EFI_DISK_READ)(EFI_DISK_IO_PROTOCOL*, UINT32, UINT64, UINTN, VOID*);
+#define EFI_BLOCK_IO_PROTOCOL_REVISION 0x00010000
+#define HARDWARE_DEVICE_PATH 0x01
+#define HW_VENDOR_DP 0x04
+typedef struct { EFI_DEVICE_PATH Header; EFI_GUID Guid; } VENDOR_DEVICE_PATH;
+#define SetDevicePathEndNode(a) do { (a)->Type = END_DEVICE_PATH_TYPE; (a)->SubType = END_ENTIRE_DEVICE_PATH_SUBTYPE; (a)->Length[0] = 4; (a)->Length[1] = 0; } while (0)
+#define MEDIA_VENDOR_DP 0x03
+
+#endif
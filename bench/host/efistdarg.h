@@ -0,0 +1,27 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Host build UEFI varargs
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_EFISTDARG_H
+#define HOST_EFISTDARG_H
+
+#include <stdarg.h>
+#define VA_LIST va_list
+#define VA_START va_start
+#define VA_END va_end
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - exFAT reader test
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../boot.h"
+#include "host.h"
+
+/*
+ * Read files from an exFAT partition image with exfat.c, and check them
+ * against reference copies. Each file is given as three arguments:
+ * - the path to look up, in any case,
+ * - the path, with the case it has on the file system,
+ * - the reference file it must match.
+ * Paths use '/' as separator and are UTF-8. The file is read with both
+ * ExFatReadFile() and ExFatGetFileExtents(), and a file that is looked up
+ * with a case that differs from the on-disk one outside of ASCII validates
+ * the up-case table. See exfattest.sh for the images we test.
+ */
+
+STATIC INT32 ImageFd = -1;
+STATIC EFI_BLOCK_IO_MEDIA Media = { .MediaPresent = TRUE, .ReadOnly = TRUE, .BlockSize = 512 };
+STATIC EFI_BLOCK_IO Block = { .Media = &Media };
+STATIC EFI_DISK_IO Disk;
+
+STATIC EFI_STATUS EFIAPI ImageReadDisk(EFI_DISK_IO* This, UINT32 MediaId, UINT64 Offset,
+	UINTN Size, VOID* Buffer)
+{
+	ssize_t Read = pread(ImageFd, Buffer, Size, (off_t)Offset);
+
+	if (Read < 0)
+		return EFI_DEVICE_ERROR;
+	// Like a partition, reads past the end of the image fail
+	return ((UINTN)Read == Size) ? EFI_SUCCESS : EFI_INVALID_PARAMETER;
+}
+
+/* Convert a UTF-8 path with '/' separators to an UEFI one */
+STATIC CHAR16* Utf8ToPath(CONST CHAR8* Utf8)
+{
+	CONST UINT8* s = (CONST UINT8*)Utf8;
+	CHAR16* Path = calloc(strlen(Utf8) + 2, sizeof(CHAR16));
+	UINTN i = 0;
+
+	if (Path == NULL)
+		abort();
+	if (*s != '/')
+		Path[i++] = L'\\';
+	while (*s != 0) {
+		if (*s == '/') {
+			Path[i++] = L'\\';
+			s++;
+		} else if (*s < 0x80) {
+			Path[i++] = *s++;
+		} else if ((*s & 0xE0) == 0xC0) {
+			Path[i++] = ((s[0] & 0x1F) << 6) | (s[1] & 0x3F);
+			s += 2;
+		} else {
+			Path[i++] = ((s[0] & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+			s += 3;
+		}
+	}
+	return Path;
+}
+
+STATIC UINT8* ReadReference(CONST CHAR8* Name, UINTN* Size)
+{
+	FILE* File = fopen(Name, "rb");
+	UINT8* Data;
+
+	if (File == NULL)
+		return NULL;
+	fseek(File, 0, SEEK_END);
+	*Size = (UINTN)ftell(File);
+	fseek(File, 0, SEEK_SET);
+	Data = malloc(*Size + 1);
+	if ((Data == NULL) || (fread(Data, 1, *Size, File) != *Size)) {
+		free(Data);
+		Data = NULL;
+	}
+	fclose(File);
+	return Data;
+}
+
+/* Check one file, and return the number of failures */
+STATIC INT32 TestFile(CONST EFI_HANDLE Handle, CONST UINT8* BootSector,
+	CONST CHAR8* Lookup, CONST CHAR8* OnDisk, CONST CHAR8* Reference)
+{
+	EFI_STATUS Status;
+	CHAR16 *Path = Utf8ToPath(Lookup), *Expected = Utf8ToPath(OnDisk);
+	UINT8 *Ref, *Data = NULL, *Mapped = NULL;
+	UINTN RefSize, DataSize, ExtentCount, i;
+	FILE_EXTENT* Extents = NULL;
+	UINT64 FileSize;
+	INT32 Failures = 0;
+
+	Ref = ReadReference(Reference, &RefSize);
+	if (Ref == NULL) {
+		printf("FAIL %s: can't read reference '%s'\n", OnDisk, Reference);
+		return 1;
+	}
+
+	Status = ExFatReadFile(Handle, BootSector, Path, (VOID**)&Data, &DataSize);
+	if (EFI_ERROR(Status)) {
+		printf("FAIL %s: ExFatReadFile() returned 0x%lx\n", OnDisk, (unsigned long)Status);
+		Failures++;
+	} else {
+		if ((DataSize != RefSize) || (memcmp(Data, Ref, RefSize) != 0)) {
+			printf("FAIL %s: ExFatReadFile() data mismatch\n", OnDisk);
+			Failures++;
+		}
+		if (StrCmp(Path, Expected) != 0) {
+			printf("FAIL %s: path case was not corrected\n", OnDisk);
+			Failures++;
+		}
+		ArenaFree(Data);
+	}
+
+	free(Path);
+	Path = Utf8ToPath(Lookup);
+	Status = ExFatGetFileExtents(Handle, BootSector, Path, &Extents, &ExtentCount, &FileSize);
+	if (EFI_ERROR(Status)) {
+		printf("FAIL %s: ExFatGetFileExtents() returned 0x%lx\n", OnDisk, (unsigned long)Status);
+		Failures++;
+	} else {
+		Mapped = calloc(1, (size_t)FileSize + 1);
+		for (i = 0; (Mapped != NULL) && (i < ExtentCount); i++) {
+			if ((Extents[i].FileOffset + Extents[i].Length > FileSize) ||
+				(ImageReadDisk(&Disk, 0, Extents[i].DiskOffset, (UINTN)Extents[i].Length,
+					&Mapped[Extents[i].FileOffset]) != EFI_SUCCESS))
+				break;
+		}
+		if ((Mapped == NULL) || (i != ExtentCount) || (FileSize != RefSize) ||
+			(memcmp(Mapped, Ref, RefSize) != 0)) {
+			printf("FAIL %s: ExFatGetFileExtents() data mismatch\n", OnDisk);
+			Failures++;
+		}
+		free(Mapped);
+		FreePool(Extents);
+	}
+
+	if (Failures == 0)
+		printf("PASS %s (%lu bytes, %lu extent(s))\n", OnDisk, (unsigned long)RefSize, (unsigned long)ExtentCount);
+	free(Path);
+	free(Expected);
+	free(Ref);
+	return Failures;
+}
+
+int main(int argc, char** argv)
+{
+	EFI_HANDLE Handle = &Disk;
+	UINT8 BootSector[512];
+	INT32 i, Failures = 0;
+
+	if ((argc < 5) || ((argc - 2) % 3 != 0)) {
+		fprintf(stderr, "Usage: %s IMAGE LOOKUP ONDISK REFERENCE [LOOKUP ONDISK REFERENCE...]\n", argv[0]);
+		return 2;
+	}
+	ImageFd = open(argv[1], O_RDONLY);
+	if (ImageFd < 0) {
+		fprintf(stderr, "Can't open '%s'\n", argv[1]);
+		return 2;
+	}
+	Disk.Revision = EFI_DISK_IO_PROTOCOL_REVISION;
+	Disk.ReadDisk = ImageReadDisk;
+	HostInstallProtocol(Handle, &gEfiBlockIoProtocolGuid, &Block);
+	HostInstallProtocol(Handle, &gEfiDiskIoProtocolGuid, &Disk);
+	if (ImageReadDisk(&Disk, 0, 0, sizeof(BootSector), BootSector) != EFI_SUCCESS) {
+		fprintf(stderr, "Can't read the boot sector of '%s'\n", argv[1]);
+		return 2;
+	}
+
+	// The reader allocates from the arena, as it does in the boot path
+	ArenaInit();
+	for (i = 2; i < argc; i += 3)
+		Failures += TestFile(Handle, BootSector, argv[i], argv[i + 1], argv[i + 2]);
+	close(ImageFd);
+	return (Failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+#!/bin/sh
+# uefi-ntfs: UEFI → NTFS/exFAT chain loader - exFAT reader test
+# Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+#
+# Formats an image with mkfs.exfat, fills it with the cases that the direct
+# exFAT reader of UEFI:NTFS has to deal with, then checks that exfattest
+# reads the same data back:
+# - a bootloader that is fragmented into many extents
+# - names longer than 15 characters, that span several name entries
+# - non-ASCII names looked up with another case, through the up-case table
+# - a file that is larger than the FAT cache window of the reader
+#
+# This requires exfatprogs and exfat-fuse.
+#
+# Usage: exfattest.sh EXFATTEST [WORK]
+# This is meant to be invoked through 'make exfattest'.
+
+set -e
+
+TEST=$1
+WORK=${2:-work-exfat}
+CLUSTER=4096
+FRAGMENTS=64
+IMAGE_SIZE=64
+
+die() {
+	echo "exfattest: $*" >&2
+	exit 1
+}
+
+[ -x "$TEST" ] || die "'$TEST' not found"
+for t in mkfs.exfat mount.exfat-fuse fusermount; do
+	command -v $t >/dev/null || die "'$t' not found"
+done
+
+rm -rf "$WORK"
+mkdir -p "$WORK/mnt" "$WORK/ref"
+
+# Same as in stress.sh: copy a file as CLUSTER sized chunks interleaved with
+# filler files that get deleted at the end, so that it ends up fragmented.
+fragment_copy() {
+	src=$1; dst=$2; dir=$(dirname "$dst")
+	size=$(stat -c %s "$src")
+	chunk=$(((size + FRAGMENTS - 1) / FRAGMENTS))
+	chunk=$(((chunk + CLUSTER - 1) / CLUSTER * CLUSTER))
+	: > "$dst"
+	i=0
+	while [ $((i * chunk)) -lt $size ]; do
+		dd if="$src" of="$dst" bs=$chunk skip=$i seek=$i count=1 conv=notrunc status=none
+		sync "$dst"
+		head -c $CLUSTER /dev/zero > "$dir/.filler$i"
+		sync "$dir/.filler$i"
+		i=$((i + 1))
+	done
+	rm -f "$dir"/.filler*
+}
+
+head -c 1000000 /dev/urandom > "$WORK/ref/loader"
+head -c 12345 /dev/urandom > "$WORK/ref/long"
+head -c 4097 /dev/urandom > "$WORK/ref/unicode"
+head -c 6000000 /dev/urandom > "$WORK/ref/large"
+
+LONG_DIR="A directory name that is longer than a single name entry"
+LONG_FILE="Another file name, with spaces, that spans many name entries.bin"
+UNICODE_FILE="Ωmega-Ñandú-Éclair.efi"
+
+truncate -s ${IMAGE_SIZE}M "$WORK/exfat.img"
+mkfs.exfat -c $CLUSTER -L EXFATTEST "$WORK/exfat.img" >/dev/null
+mount.exfat-fuse "$WORK/exfat.img" "$WORK/mnt"
+mkdir -p "$WORK/mnt/EFI/Boot" "$WORK/mnt/$LONG_DIR"
+fragment_copy "$WORK/ref/loader" "$WORK/mnt/EFI/Boot/bootx64.efi"
+cp "$WORK/ref/long" "$WORK/mnt/$LONG_DIR/$LONG_FILE"
+cp "$WORK/ref/unicode" "$WORK/mnt/EFI/$UNICODE_FILE"
+cp "$WORK/ref/large" "$WORK/mnt/large.bin"
+fusermount -u "$WORK/mnt"
+
+"$TEST" "$WORK/exfat.img" \
+	"efi/boot/BOOTX64.efi" "EFI/Boot/bootx64.efi" "$WORK/ref/loader" \
+	"a DIRECTORY name that is longer than a single name entry/$LONG_FILE" \
+	"$LONG_DIR/$LONG_FILE" "$WORK/ref/long" \
+	"efi/ωMEGA-ñANDÚ-éCLAIR.EFI" "EFI/$UNICODE_FILE" "$WORK/ref/unicode" \
+	"LARGE.BIN" "large.bin" "$WORK/ref/large"
+rm -rf "$WORK"
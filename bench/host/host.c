@@ -0,0 +1,239 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Host build UEFI emulation
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../boot.h"
+#include "host.h"
+
+/*
+ * Just enough of the gnu-efi library and of the boot and runtime services for
+ * the parsers to run on the build host. Console output is discarded, protocol
+ * and variable lookups fail, and pool and page allocations come from malloc(),
+ * with a count that the host programs report.
+ */
+EFI_HANDLE MainImageHandle = NULL;
+UINTN HostAllocations = 0;
+
+EFI_GUID gEfiDiskIoProtocolGuid = { 0xce345171, 0xba0b, 0x11d2, { 0x8e, 0x4f, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } };
+EFI_GUID gEfiDiskIo2ProtocolGuid = { 0x151c8eae, 0x7f2c, 0x472c, { 0x9e, 0x54, 0x98, 0x28, 0x19, 0x4f, 0x6a, 0x88 } };
+EFI_GUID gEfiBlockIoProtocolGuid = { 0x964e5b21, 0x6459, 0x11d2, { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } };
+EFI_GUID gEfiBlockIo2ProtocolGuid = { 0xa77b2472, 0xe282, 0x4e9f, { 0xa2, 0x45, 0xc2, 0xc0, 0xe2, 0x7b, 0xbc, 0xc1 } };
+EFI_GUID gEfiSimpleFileSystemProtocolGuid = { 0x964e5b22, 0x6459, 0x11d2, { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } };
+EFI_GUID gEfiLoadedImageProtocolGuid = { 0x5b1b31a1, 0x9562, 0x11d2, { 0x8e, 0x3f, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } };
+EFI_GUID gEfiDevicePathProtocolGuid = { 0x09576e91, 0x6d3f, 0x11d2, { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } };
+EFI_GUID gEfiDevicePathToTextProtocolGuid = { 0x8b843e20, 0x8132, 0x4852, { 0x90, 0xcc, 0x55, 0x1a, 0x4e, 0x4a, 0x7f, 0x1c } };
+EFI_GUID gEfiComponentNameProtocolGuid = { 0x107a772c, 0xd5e1, 0x11d4, { 0x9a, 0x46, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d } };
+EFI_GUID gEfiComponentName2ProtocolGuid = { 0x6a7a5cff, 0xe8d9, 0x4f70, { 0xba, 0xda, 0x75, 0xab, 0x30, 0x25, 0xce, 0x14 } };
+EFI_GUID gEfiDriverBindingProtocolGuid = { 0x18a031ab, 0xb443, 0x4d1a, { 0xa5, 0xc0, 0x0c, 0x09, 0x26, 0x1e, 0x9f, 0x71 } };
+EFI_GUID gEfiFileInfoGuid = { 0x09576e92, 0x6d3f, 0x11d2, { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } };
+EFI_GUID gEfiFileSystemInfoGuid = { 0x09576e93, 0x6d3f, 0x11d2, { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } };
+EFI_GUID gEfiFileSystemVolumeLabelInfoIdGuid = { 0xdb47d7d3, 0xfe81, 0x11d3, { 0x9a, 0x35, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d } };
+EFI_GUID gEfiSmbiosTableGuid = { 0xeb9d2d31, 0x2d88, 0x11d3, { 0x9a, 0x16, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d } };
+EFI_GUID gEfiSmbios3TableGuid = { 0xf2fd1544, 0x9794, 0x4a2c, { 0x99, 0x2e, 0xe5, 0xbb, 0xcf, 0x20, 0xe3, 0x94 } };
+EFI_GUID gEfiGlobalVariableGuid = { 0x8be4df61, 0x93ca, 0x11d2, { 0xaa, 0x0d, 0x00, 0xe0, 0x98, 0x03, 0x2b, 0x8c } };
+EFI_GUID gEfiEventExitBootServicesGuid = { 0x27abf055, 0xb1b8, 0x4c26, { 0x80, 0x48, 0x74, 0x8f, 0x37, 0xba, 0xa2, 0xdf } };
+EFI_GUID gEfiLoadedImageDevicePathProtocolGuid = { 0xbc62157e, 0x3e33, 0x4fec, { 0x99, 0x20, 0x2d, 0x3b, 0x36, 0xd7, 0x50, 0xdf } };
+
+VOID* AllocatePool(UINTN Size)
+{
+	HostAllocations++;
+	return malloc(Size);
+}
+
+VOID* AllocateZeroPool(UINTN Size)
+{
+	HostAllocations++;
+	return calloc(1, Size);
+}
+
+VOID FreePool(VOID* Buffer)
+{
+	free(Buffer);
+}
+
+STATIC EFI_STATUS EFIAPI HostAllocatePages(EFI_ALLOCATE_TYPE Type, EFI_MEMORY_TYPE MemoryType,
+	UINTN Pages, EFI_PHYSICAL_ADDRESS* Memory)
+{
+	VOID* Buffer;
+
+	if (Type != AllocateAnyPages)
+		return EFI_UNSUPPORTED;
+	Buffer = aligned_alloc(EFI_PAGE_SIZE, EFI_PAGES_TO_SIZE(Pages));
+	if (Buffer == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	HostAllocations++;
+	*Memory = (EFI_PHYSICAL_ADDRESS)(UINTN)Buffer;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostFreePages(EFI_PHYSICAL_ADDRESS Memory, UINTN Pages)
+{
+	free((VOID*)(UINTN)Memory);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI HostOpenProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, VOID** Interface,
+	EFI_HANDLE AgentHandle, EFI_HANDLE ControllerHandle, UINT32 Attributes)
+{
+	return HostGetProtocol(Handle, Protocol, Interface);
+}
+
+STATIC EFI_STATUS EFIAPI HostHandleProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, VOID** Interface)
+{
+	return HostGetProtocol(Handle, Protocol, Interface);
+}
+
+STATIC EFI_STATUS EFIAPI HostLocateProtocol(EFI_GUID* Protocol, VOID* Registration, VOID** Interface)
+{
+	return EFI_NOT_FOUND;
+}
+
+STATIC EFI_STATUS EFIAPI HostGetVariable(CHAR16* Name, EFI_GUID* Guid, UINT32* Attributes,
+	UINTN* Size, VOID* Data)
+{
+	return EFI_NOT_FOUND;
+}
+
+STATIC EFI_STATUS EFIAPI HostSetAttribute(SIMPLE_TEXT_OUTPUT_INTERFACE* This, UINTN Attribute)
+{
+	return EFI_SUCCESS;
+}
+
+STATIC SIMPLE_TEXT_OUTPUT_INTERFACE HostConOut = { .SetAttribute = HostSetAttribute };
+STATIC EFI_BOOT_SERVICES HostBootServices = {
+	.AllocatePages = HostAllocatePages,
+	.FreePages = HostFreePages,
+	.HandleProtocol = HostHandleProtocol,
+	.OpenProtocol = HostOpenProtocol,
+	.LocateProtocol = HostLocateProtocol,
+};
+STATIC EFI_RUNTIME_SERVICES HostRuntimeServices = { .GetVariable = HostGetVariable };
+STATIC EFI_SYSTEM_TABLE HostSystemTable = {
+	.FirmwareVendor = L"Host",
+	.ConOut = &HostConOut,
+	.RuntimeServices = &HostRuntimeServices,
+	.BootServices = &HostBootServices,
+};
+
+EFI_SYSTEM_TABLE *gST = &HostSystemTable, *ST = &HostSystemTable;
+EFI_BOOT_SERVICES *gBS = &HostBootServices, *BS = &HostBootServices;
+EFI_RUNTIME_SERVICES *gRT = &HostRuntimeServices, *RT = &HostRuntimeServices;
+
+/* The protocols of the handles the host programs create */
+STATIC struct {
+	EFI_HANDLE Handle;
+	EFI_GUID* Protocol;
+	VOID* Interface;
+} HostProtocol[16];
+
+VOID HostInstallProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, VOID* Interface)
+{
+	UINTN i;
+
+	for (i = 0; i < ARRAY_SIZE(HostProtocol); i++) {
+		if (HostProtocol[i].Handle == NULL) {
+			HostProtocol[i].Handle = Handle;
+			HostProtocol[i].Protocol = Protocol;
+			HostProtocol[i].Interface = Interface;
+			return;
+		}
+	}
+	abort();
+}
+
+EFI_STATUS HostGetProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, VOID** Interface)
+{
+	UINTN i;
+
+	for (i = 0; i < ARRAY_SIZE(HostProtocol); i++) {
+		if ((HostProtocol[i].Handle == Handle) && (HostProtocol[i].Protocol == Protocol)) {
+			if (Interface != NULL)
+				*Interface = HostProtocol[i].Interface;
+			return EFI_SUCCESS;
+		}
+	}
+	return EFI_UNSUPPORTED;
+}
+
+UINTN Print(CONST CHAR16* Format, ...)
+{
+	return 0;
+}
+
+UINTN StrLen(CONST CHAR16* String)
+{
+	UINTN Len;
+
+	for (Len = 0; String[Len] != 0; Len++);
+	return Len;
+}
+
+UINTN StrSize(CONST CHAR16* String)
+{
+	return (StrLen(String) + 1) * sizeof(CHAR16);
+}
+
+INTN StrCmp(CONST CHAR16* s1, CONST CHAR16* s2)
+{
+	while ((*s1 != 0) && (*s1 == *s2))
+		s1++, s2++;
+	return (INTN)*s1 - (INTN)*s2;
+}
+
+INTN StrnCmp(CONST CHAR16* s1, CONST CHAR16* s2, UINTN Len)
+{
+	for (; Len > 0; Len--, s1++, s2++) {
+		if ((*s1 != *s2) || (*s1 == 0))
+			return (INTN)*s1 - (INTN)*s2;
+	}
+	return 0;
+}
+
+UINTN AsciiStrLen(CONST CHAR8* String)
+{
+	return strlen(String);
+}
+
+BOOLEAN CompareGuid(CONST EFI_GUID* Guid1, CONST EFI_GUID* Guid2)
+{
+	return memcmp(Guid1, Guid2, sizeof(EFI_GUID)) == 0;
+}
+
+VOID SetMem(VOID* Buffer, UINTN Size, UINT8 Value)
+{
+	memset(Buffer, Value, Size);
+}
+
+CHAR16* DevicePathToStr(EFI_DEVICE_PATH* DevicePath)
+{
+	return NULL;
+}
+
+UINT64 DivU64x32(UINT64 Dividend, UINTN Divisor, UINTN* Remainder)
+{
+	if (Remainder != NULL)
+		*Remainder = (UINTN)(Dividend % Divisor);
+	return Dividend / Divisor;
+}
+
+UINT64 MultU64x32(UINT64 Multiplicand, UINTN Multiplier)
+{
+	return Multiplicand * Multiplier;
+}
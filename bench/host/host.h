@@ -0,0 +1,26 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Host build UEFI emulation
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This must be included after boot.h, which has no include guard */
+
+/* Number of pool and page allocations performed so far */
+extern UINTN HostAllocations;
+
+/* Attach a protocol interface to a handle, for HandleProtocol()/OpenProtocol() */
+VOID HostInstallProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, VOID* Interface);
+EFI_STATUS HostGetProtocol(EFI_HANDLE Handle, EFI_GUID* Protocol, VOID** Interface);
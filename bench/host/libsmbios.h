@@ -0,0 +1,31 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Host build SMBIOS types
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_LIBSMBIOS_H
+#define HOST_LIBSMBIOS_H
+
+typedef struct { UINT8 Type; UINT8 Length; UINT16 Handle; } SMBIOS_STRUCTURE;
+typedef UINT8 SMBIOS_TABLE_STRING;
+typedef struct { SMBIOS_STRUCTURE Hdr; SMBIOS_TABLE_STRING Vendor; SMBIOS_TABLE_STRING BiosVersion; UINT16 BiosSegment; SMBIOS_TABLE_STRING BiosReleaseDate; UINT8 BiosSize; UINT64 BiosCharacteristics; } SMBIOS_TYPE0;
+typedef struct { SMBIOS_STRUCTURE Hdr; SMBIOS_TABLE_STRING Manufacturer; SMBIOS_TABLE_STRING ProductName; SMBIOS_TABLE_STRING Version; SMBIOS_TABLE_STRING SerialNumber; EFI_GUID Uuid; UINT8 WakeUpType; SMBIOS_TABLE_STRING SKUNumber; SMBIOS_TABLE_STRING Family; } __attribute__((packed)) SMBIOS_TYPE1;
+typedef struct { SMBIOS_STRUCTURE Hdr; SMBIOS_TABLE_STRING Manufacturer; SMBIOS_TABLE_STRING ProductName; SMBIOS_TABLE_STRING Version; SMBIOS_TABLE_STRING SerialNumber; } SMBIOS_TYPE2;
+typedef union { SMBIOS_STRUCTURE* Hdr; SMBIOS_TYPE0* Type0; SMBIOS_TYPE1* Type1; SMBIOS_TYPE2* Type2; UINT8* Raw; } SMBIOS_STRUCTURE_POINTER;
+typedef struct { UINT8 AnchorString[4]; UINT8 EntryPointStructureChecksum; UINT8 EntryPointLength; UINT8 MajorVersion; UINT8 MinorVersion; UINT16 MaxStructureSize; UINT8 EntryPointRevision; UINT8 FormattedArea[5]; UINT8 IntermediateAnchorString[5]; UINT8 IntermediateChecksum; UINT16 TableLength; UINT32 TableAddress; UINT16 NumberOfSmbiosStructures; UINT8 SmbiosBcdRevision; } __attribute__((packed)) SMBIOS_TABLE_ENTRY_POINT;
+typedef struct { UINT8 AnchorString[5]; UINT8 EntryPointStructureChecksum; UINT8 EntryPointLength; UINT8 MajorVersion; UINT8 MinorVersion; UINT8 DocRev; UINT8 EntryPointRevision; UINT8 Reserved; UINT32 TableMaximumSize; UINT64 TableAddress; } __attribute__((packed)) SMBIOS_TABLE_3_0_ENTRY_POINT;
+
+#endif
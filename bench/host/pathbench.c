@@ -0,0 +1,277 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Path and system info benchmark
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* We need the SMBIOS index of system.c, to make every run walk the table */
+#include "../../system.c"
+#include "host.h"
+
+/* Not exported by boot.h, since it's only used by path.c */
+CHAR16* DevicePathToHex(CONST EFI_DEVICE_PATH* DevicePath);
+
+/* Number of entries, besides the one we look for, in each directory */
+#define DIRECTORY_ENTRIES   4096
+
+/* Size of the synthetic SMBIOS table, which is the sanity limit of system.c */
+#define SMBIOS_SIZE         (1024 * 1024)
+
+/* Minimum duration of each test, in nanoseconds */
+#define BENCH_NS            200000000ULL
+
+/*
+ * An in-memory EFI_FILE, where the directory at each depth holds
+ * DIRECTORY_ENTRIES files, followed by the path component we look for.
+ */
+typedef struct {
+	EFI_FILE File;
+	UINTN Depth;
+	UINTN Position;
+} HOST_DIRECTORY;
+
+STATIC CONST CHAR16* PathComponent[] = { L"EFI", L"Boot", L"BOOTX64.EFI" };
+
+STATIC EFI_STATUS EFIAPI DirOpen(EFI_FILE* This, EFI_FILE** NewHandle, CHAR16* FileName,
+	UINT64 OpenMode, UINT64 Attributes);
+
+STATIC EFI_STATUS EFIAPI DirClose(EFI_FILE* This)
+{
+	free(This);
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI DirSetPosition(EFI_FILE* This, UINT64 Position)
+{
+	((HOST_DIRECTORY*)This)->Position = (UINTN)Position;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI DirRead(EFI_FILE* This, UINTN* BufferSize, VOID* Buffer)
+{
+	HOST_DIRECTORY* Dir = (HOST_DIRECTORY*)This;
+	EFI_FILE_INFO* Info = (EFI_FILE_INFO*)Buffer;
+	CHAR16 Name[16];
+	CONST CHAR16* FileName = Name;
+	UINTN i, Size;
+
+	if (Dir->Position > DIRECTORY_ENTRIES || Dir->Depth >= ARRAY_SIZE(PathComponent)) {
+		*BufferSize = 0;
+		return EFI_SUCCESS;
+	}
+	if (Dir->Position == DIRECTORY_ENTRIES) {
+		FileName = PathComponent[Dir->Depth];
+	} else {
+		for (i = 0; i < 8; i++)
+			Name[i] = L"0123456789ABCDEF"[(Dir->Position >> (4 * (7 - i))) & 0xF];
+		Name[8] = L'.';
+		Name[9] = L'D';
+		Name[10] = L'A';
+		Name[11] = L'T';
+		Name[12] = 0;
+	}
+	Size = sizeof(EFI_FILE_INFO) + StrSize(FileName);
+	if (*BufferSize < Size) {
+		*BufferSize = Size;
+		return EFI_BUFFER_TOO_SMALL;
+	}
+	Info->Size = Size;
+	Info->Attribute = (Dir->Position == DIRECTORY_ENTRIES && Dir->Depth < 2) ? EFI_FILE_DIRECTORY : 0;
+	memcpy(Info->FileName, FileName, StrSize(FileName));
+	*BufferSize = Size;
+	Dir->Position++;
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_FILE* NewDirectory(CONST UINTN Depth)
+{
+	HOST_DIRECTORY* Dir = calloc(1, sizeof(HOST_DIRECTORY));
+
+	if (Dir == NULL)
+		abort();
+	Dir->File.Revision = 0x00010000;
+	Dir->File.Open = DirOpen;
+	Dir->File.Close = DirClose;
+	Dir->File.Read = DirRead;
+	Dir->File.SetPosition = DirSetPosition;
+	Dir->Depth = Depth;
+	return &Dir->File;
+}
+
+/* Opening "\" gives the root directory, and each extra component goes one level deeper */
+STATIC EFI_STATUS EFIAPI DirOpen(EFI_FILE* This, EFI_FILE** NewHandle, CHAR16* FileName,
+	UINT64 OpenMode, UINT64 Attributes)
+{
+	UINTN Depth = 0;
+
+	for (; *FileName != 0; FileName++) {
+		if ((*FileName == L'\\') && (FileName[1] != 0))
+			Depth++;
+	}
+	*NewHandle = NewDirectory(Depth);
+	return EFI_SUCCESS;
+}
+
+/*
+ * Build the device path of a partition on a USB drive, followed by a file path.
+ */
+STATIC EFI_DEVICE_PATH* BuildDevicePath(VOID)
+{
+	STATIC CONST UINT8 Nodes[] = {
+		0x02, 0x01, 0x0c, 0x00, 0xd0, 0x41, 0x03, 0x0a, 0x00, 0x00, 0x00, 0x00,    // PciRoot(0x0)
+		0x01, 0x01, 0x06, 0x00, 0x00, 0x14,                                        // Pci(0x14,0x0)
+		0x03, 0x05, 0x06, 0x00, 0x03, 0x00,                                        // USB(0x3,0x0)
+		0x04, 0x01, 0x2a, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00,    // HD(2,MBR,...)
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x01, 0x01,
+	};
+	CONST CHAR16 File[] = L"\\efi\\boot\\bootx64.efi";
+	UINT8* Path = malloc(sizeof(Nodes) + 4 + sizeof(File) + 4);
+	EFI_DEVICE_PATH* Node;
+
+	if (Path == NULL)
+		abort();
+	memcpy(Path, Nodes, sizeof(Nodes));
+	Node = (EFI_DEVICE_PATH*)&Path[sizeof(Nodes)];
+	Node->Type = MEDIA_DEVICE_PATH;
+	Node->SubType = MEDIA_FILEPATH_DP;
+	SetDevicePathNodeLength(Node, 4 + sizeof(File));
+	memcpy(&Path[sizeof(Nodes) + 4], File, sizeof(File));
+	SetDevicePathEndNode(NextDevicePathNode(Node));
+	return (EFI_DEVICE_PATH*)Path;
+}
+
+/*
+ * Build an SMBIOS 3.0 table of Size bytes, where the Type 0 and 1
+ * structures come last, and register it as a configuration table.
+ */
+STATIC VOID BuildSmbiosTable(CONST UINTN Size)
+{
+	STATIC SMBIOS_TABLE_3_0_ENTRY_POINT EntryPoint = { { '_', 'S', 'M', '3', '_' } };
+	STATIC EFI_CONFIGURATION_TABLE ConfigurationTable;
+	STATIC CONST CHAR8 Filler[] = "Filler\0String\0";
+	STATIC CONST CHAR8 Type0[] = "American Megatrends Inc.\0" "1.2.3\0";
+	STATIC CONST CHAR8 Type1[] = "Host\0" "Synthetic Platform\0";
+	UINT8* Table = calloc(1, Size);
+	UINTN Offset = 0, Tail = 0x40 + sizeof(Type0) + sizeof(Type1) + 8;
+	SMBIOS_STRUCTURE* Hdr;
+
+	if (Table == NULL)
+		abort();
+	while (Offset + 8 + sizeof(Filler) + Tail <= Size) {
+		Hdr = (SMBIOS_STRUCTURE*)&Table[Offset];
+		Hdr->Type = 0x7E;
+		Hdr->Length = 8;
+		Table[Offset + 4] = 1;
+		memcpy(&Table[Offset + 8], Filler, sizeof(Filler));
+		Offset += 8 + sizeof(Filler);
+	}
+	Hdr = (SMBIOS_STRUCTURE*)&Table[Offset];
+	Hdr->Type = 0;
+	Hdr->Length = sizeof(SMBIOS_TYPE0);
+	((SMBIOS_TYPE0*)Hdr)->Vendor = 1;
+	((SMBIOS_TYPE0*)Hdr)->BiosVersion = 2;
+	Offset += Hdr->Length;
+	memcpy(&Table[Offset], Type0, sizeof(Type0));
+	Offset += sizeof(Type0);
+	Hdr = (SMBIOS_STRUCTURE*)&Table[Offset];
+	Hdr->Type = 1;
+	Hdr->Length = sizeof(SMBIOS_TYPE1);
+	((SMBIOS_TYPE1*)Hdr)->Manufacturer = 1;
+	((SMBIOS_TYPE1*)Hdr)->ProductName = 2;
+	Offset += Hdr->Length;
+	memcpy(&Table[Offset], Type1, sizeof(Type1));
+	Offset += sizeof(Type1);
+	Table[Offset] = 0x7F;
+	Table[Offset + 1] = 4;
+
+	EntryPoint.TableAddress = (UINT64)(UINTN)Table;
+	EntryPoint.TableMaximumSize = (UINT32)Size;
+	ConfigurationTable.VendorGuid = gEfiSmbios3TableGuid;
+	ConfigurationTable.VendorTable = &EntryPoint;
+	gST->NumberOfTableEntries = 1;
+	gST->ConfigurationTable = &ConfigurationTable;
+}
+
+STATIC UINT64 Now(VOID)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64)ts.tv_sec * 1000000000ULL + (UINT64)ts.tv_nsec;
+}
+
+/*
+ * Run a test until it has lasted BENCH_NS, then report ns/op and allocations/op.
+ */
+#define BENCH(Name, Statement) do {                                                     \
+	UINT64 _Start = Now(), _Elapsed;                                                    \
+	UINTN _Ops = 0, _Allocations = HostAllocations;                                     \
+	do {                                                                                \
+		Statement;                                                                      \
+		_Ops++;                                                                         \
+	} while ((_Elapsed = Now() - _Start) < BENCH_NS);                                   \
+	printf("%-28s %12.1f ns/op %8.2f allocs/op\n", Name, (double)_Elapsed / _Ops,      \
+		(double)(HostAllocations - _Allocations) / _Ops);                               \
+} while (0)
+
+int main(void)
+{
+	EFI_DEVICE_PATH *Path1 = BuildDevicePath(), *Path2 = BuildDevicePath(), *Parent;
+	EFI_FILE* Root = NewDirectory(0);
+	CHAR16 LoaderPath[64], *String;
+	SMBIOS_STRUCTURE_POINTER Smbios;
+	volatile INTN Result = 0;
+
+	// The arena is left uninitialized, so that every ArenaAllocate() is counted
+	BuildSmbiosTable(SMBIOS_SIZE);
+	if (CompareDevicePaths(Path1, Path2) != 0) {
+		fprintf(stderr, "CompareDevicePaths: identical paths differ\n");
+		return 1;
+	}
+	SafeStrCpy(LoaderPath, ARRAY_SIZE(LoaderPath), L"\\efi\\boot\\bootx64.efi");
+	if ((SetPathCase(Root, LoaderPath) != EFI_SUCCESS) ||
+		(StrCmp(LoaderPath, L"\\EFI\\Boot\\BOOTX64.EFI") != 0)) {
+		fprintf(stderr, "SetPathCase: path was not fixed\n");
+		return 1;
+	}
+	if ((PrintSystemInfo() != EFI_SUCCESS) || (GetProductName() == NULL) ||
+		(strcmp(GetProductName(), "Synthetic Platform") != 0)) {
+		fprintf(stderr, "PrintSystemInfo: synthetic SMBIOS table not parsed\n");
+		return 1;
+	}
+
+	BENCH("CompareDevicePaths", Result += CompareDevicePaths(Path1, Path2));
+	BENCH("GetParentDevice", Parent = GetParentDevice(Path1); ArenaFree(Parent));
+	BENCH("DevicePathToHex", String = DevicePathToHex(Path1); ArenaFree(String));
+	BENCH("SetPathCase (4096 entries)",
+		SafeStrCpy(LoaderPath, ARRAY_SIZE(LoaderPath), L"\\efi\\boot\\bootx64.efi");
+		Result += SetPathCase(Root, LoaderPath));
+	BENCH("GetSmbiosString", Smbios.Hdr = SmbiosIndex[1];
+		Result += (INTN)(UINTN)GetSmbiosString(&Smbios, 2));
+	BENCH("PrintSystemInfo (1 MiB)", SmbiosIndexStatus = EFI_NOT_STARTED;
+		ZeroMem(SmbiosIndex, sizeof(SmbiosIndex)); Result += PrintSystemInfo());
+
+	Root->Close(Root);
+	free(Path1);
+	free(Path2);
+	return 0;
+}
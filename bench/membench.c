@@ -0,0 +1,122 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Memory primitives benchmark
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../boot.h"
+
+/* We want to call the gnu-efi versions, to compare them with ours */
+#undef CompareMem
+#undef CopyMem
+#undef ZeroMem
+
+/* Amount of data each test processes, whatever the size of the calls */
+#define BENCH_BYTES         (16 * 1024 * 1024)
+
+/* The size of the image we search for the bootmgr signature in */
+#define SCAN_SIZE           (1024 * 1024)
+
+STATIC CONST UINTN CallSize[] = { 16, 64, 512, 4096, 65536 };
+
+/*
+ * Print how long a test took, along with its throughput.
+ */
+STATIC VOID Report(CONST CHAR16* Name, CONST UINTN Size, CONST UINT64 Ticks)
+{
+	UINT64 Microseconds = TicksToMicroseconds(Ticks);
+
+	Print(L"  %-16s %6d bytes: %8ld us", Name, Size, Microseconds);
+	if (Microseconds != 0)
+		Print(L" (%ld MB/s)", DivU64x32(BENCH_BYTES, (UINTN)Microseconds, NULL));
+	Print(L"\n");
+}
+
+/*
+ * Minimal application for the membench target, that times the gnu-efi
+ * memory primitives against the ones from mem.c, on the current arch.
+ */
+EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
+{
+	UINT8 *Source, *Destination;
+	CHAR8 Pattern[] = "bootmgr.dll";
+	UINTN i, j, Count;
+	UINT64 Start;
+
+	InitializeLib(ImageHandle, SystemTable);
+	Source = AllocatePool(BENCH_BYTES);
+	Destination = AllocatePool(BENCH_BYTES);
+	if (Source == NULL || Destination == NULL) {
+		Print(L"Could not allocate buffers\n");
+		goto out;
+	}
+	for (i = 0; i < BENCH_BYTES; i++)
+		Source[i] = (UINT8)(i * 7);
+	// Calibrate the counter before we time anything
+	TicksToMicroseconds(0);
+
+	Print(L"Memory primitives (%d MB per test):\n", BENCH_BYTES / (1024 * 1024));
+	for (i = 0; i < ARRAY_SIZE(CallSize); i++) {
+		Count = BENCH_BYTES / CallSize[i];
+
+		Start = GetTimestamp();
+		for (j = 0; j < Count; j++)
+			CopyMem(&Destination[j * CallSize[i]], &Source[j * CallSize[i]], CallSize[i]);
+		Report(L"CopyMem", CallSize[i], GetTimestamp() - Start);
+		Start = GetTimestamp();
+		for (j = 0; j < Count; j++)
+			FastCopyMem(&Destination[j * CallSize[i]], &Source[j * CallSize[i]], CallSize[i]);
+		Report(L"FastCopyMem", CallSize[i], GetTimestamp() - Start);
+
+		// The buffers are now the same, so these have to go through all the data
+		Start = GetTimestamp();
+		for (j = 0; j < Count; j++)
+			CompareMem(&Destination[j * CallSize[i]], &Source[j * CallSize[i]], CallSize[i]);
+		Report(L"CompareMem", CallSize[i], GetTimestamp() - Start);
+		Start = GetTimestamp();
+		for (j = 0; j < Count; j++)
+			FastCompareMem(&Destination[j * CallSize[i]], &Source[j * CallSize[i]], CallSize[i]);
+		Report(L"FastCompareMem", CallSize[i], GetTimestamp() - Start);
+
+		Start = GetTimestamp();
+		for (j = 0; j < Count; j++)
+			ZeroMem(&Destination[j * CallSize[i]], CallSize[i]);
+		Report(L"ZeroMem", CallSize[i], GetTimestamp() - Start);
+		Start = GetTimestamp();
+		for (j = 0; j < Count; j++)
+			FastZeroMem(&Destination[j * CallSize[i]], CallSize[i]);
+		Report(L"FastZeroMem", CallSize[i], GetTimestamp() - Start);
+	}
+
+	// Same as the bootmgr signature scan, over an image that doesn't have it
+	Print(L"Signature scan (%d KB):\n", SCAN_SIZE / 1024);
+	Start = GetTimestamp();
+	for (i = 0; i < SCAN_SIZE - sizeof(Pattern); i++) {
+		if (CompareMem(&Source[i], Pattern, sizeof(Pattern)) == 0)
+			break;
+	}
+	Print(L"  %-16s %8ld us\n", L"CompareMem loop", TicksToMicroseconds(GetTimestamp() - Start));
+	Start = GetTimestamp();
+	FindMem(Source, SCAN_SIZE, Pattern, sizeof(Pattern));
+	Print(L"  %-16s %8ld us\n", L"FindMem", TicksToMicroseconds(GetTimestamp() - Start));
+
+out:
+	if (Source != NULL)
+		FreePool(Source);
+	if (Destination != NULL)
+		FreePool(Destination);
+	gRT->ResetSystem(EfiResetShutdown, EFI_SUCCESS, 0, NULL);
+	return EFI_SUCCESS;
+}
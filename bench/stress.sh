@@ -0,0 +1,200 @@
+#!/bin/sh
+# uefi-ntfs: UEFI → NTFS/exFAT chain loader - Stress image generator
+# Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+#
+# Builds adversarial boot media, to see how the partition scan, the volume
+# open and the path case lookups behave at the extremes we get on customer
+# prepared drives:
+# - many partitions on the same disk, with the target coming after decoys
+#   that include NTFS and exFAT partitions the probe must reject, and being
+#   followed by plain NTFS and exFAT partitions
+# - \efi and \efi\boot directories with tens of thousands of entries
+# - heavily fragmented bootloader and driver files
+# - 4K native sectors
+#
+# This requires the same tools as bench.sh.
+#
+# Usage: stress.sh -a ARCH -l LOADER -p PAYLOAD [-d NTFS_DRIVER] [-e EXFAT_DRIVER]
+#                  [-f ntfs|exfat] [-n ENTRIES] [-c PARTITIONS] [-s SECTOR_SIZE]
+#                  [-x FRAGMENTS] [-o OUTPUT]
+
+set -e
+
+FS=exfat
+ENTRIES=20000
+PARTITIONS=32
+SECTOR_SIZE=512
+FRAGMENTS=256
+NTFS_DRIVER=
+EXFAT_DRIVER=
+
+# Size of the partitions, in MB
+ESP_SIZE=32
+DECOY_SIZE=8
+TARGET_SIZE=256
+
+die() {
+	echo "stress: $*" >&2
+	exit 1
+}
+
+while getopts "a:l:p:d:e:f:n:c:s:x:o:" opt; do
+	case $opt in
+	a) ARCH=$OPTARG ;;
+	l) LOADER=$OPTARG ;;
+	p) PAYLOAD=$OPTARG ;;
+	d) NTFS_DRIVER=$OPTARG ;;
+	e) EXFAT_DRIVER=$OPTARG ;;
+	f) FS=$OPTARG ;;
+	n) ENTRIES=$OPTARG ;;
+	c) PARTITIONS=$OPTARG ;;
+	s) SECTOR_SIZE=$OPTARG ;;
+	x) FRAGMENTS=$OPTARG ;;
+	o) OUTPUT=$OPTARG ;;
+	*) die "invalid option" ;;
+	esac
+done
+[ -n "$ARCH" ] && [ -f "$LOADER" ] && [ -f "$PAYLOAD" ] || die "ARCH, LOADER and PAYLOAD are required"
+[ $FS = ntfs ] || [ $FS = exfat ] || die "unsupported file system '$FS'"
+[ $FS = exfat ] || [ -f "$NTFS_DRIVER" ] || die "an NTFS driver is required for NTFS targets"
+[ -z "$EXFAT_DRIVER" ] || [ -f "$EXFAT_DRIVER" ] || \
+	echo "stress: '$EXFAT_DRIVER' not found, exFAT targets will boot without its driver"
+[ $SECTOR_SIZE = 512 ] || [ $SECTOR_SIZE = 4096 ] || die "unsupported sector size '$SECTOR_SIZE'"
+[ $PARTITIONS -ge 4 ] && [ $PARTITIONS -le 128 ] || die "the number of partitions must be in [4-128]"
+OUTPUT=${OUTPUT:-bench/stress-$FS-$ARCH.disk}
+WORK=$OUTPUT.work
+
+rm -rf "$WORK"
+mkdir -p "$WORK/mnt"
+
+# Copy a file as CLUSTER sized chunks interleaved with filler files that
+# get deleted at the end, so that it ends up split into many extents.
+# This works with any allocator, as long as writes are not delayed.
+fragment_copy() {
+	src=$1; dst=$2; dir=$(dirname "$dst")
+	size=$(stat -c %s "$src")
+	chunk=$(((size + FRAGMENTS - 1) / FRAGMENTS))
+	chunk=$(((chunk + CLUSTER - 1) / CLUSTER * CLUSTER))
+	: > "$dst"
+	i=0
+	while [ $((i * chunk)) -lt $size ]; do
+		dd if="$src" of="$dst" bs=$chunk skip=$i seek=$i count=1 conv=notrunc status=none
+		sync "$dst"
+		head -c $CLUSTER /dev/zero > "$dir/.filler$i"
+		sync "$dir/.filler$i"
+		i=$((i + 1))
+	done
+	rm -f "$dir"/.filler*
+}
+
+# Populate a directory with ENTRIES empty files
+populate() {
+	seq -f "$1/entry%06g.dat" 1 $ENTRIES | xargs touch
+}
+
+# Copy a driver to the ESP. With one sector per cluster and the driver
+# written into the holes left by deleted files, the file ends up fragmented.
+esp_fragment_copy() {
+	head -c $FAT_SECTOR /dev/zero > "$WORK/filler"
+	i=0
+	while [ $i -lt $((FRAGMENTS * 2)) ]; do
+		mcopy -i "$WORK/esp.img" "$WORK/filler" ::/filler/f$i
+		i=$((i + 1))
+	done
+	i=0
+	while [ $i -lt $((FRAGMENTS * 2)) ]; do
+		mdel -i "$WORK/esp.img" ::/filler/f$i
+		i=$((i + 2))
+	done
+	mcopy -i "$WORK/esp.img" "$1" ::/efi/rufus/$2
+	mdeltree -i "$WORK/esp.img" ::/filler
+	mmd -i "$WORK/esp.img" ::/filler
+}
+
+# The ESP, with the drivers we were given
+FAT_SECTOR=$SECTOR_SIZE
+mkfs.fat -S $FAT_SECTOR -s 1 -C "$WORK/esp.img" $((ESP_SIZE * 1024)) >/dev/null
+mmd -i "$WORK/esp.img" ::/efi ::/efi/boot ::/efi/rufus ::/filler
+mcopy -i "$WORK/esp.img" "$LOADER" ::/efi/boot/boot$ARCH.efi
+[ -f "$NTFS_DRIVER" ] && esp_fragment_copy "$NTFS_DRIVER" ntfs_$ARCH.efi
+[ -f "$EXFAT_DRIVER" ] && esp_fragment_copy "$EXFAT_DRIVER" exfat_$ARCH.efi
+
+# The target partition
+truncate -s ${TARGET_SIZE}M "$WORK/target.img"
+case $FS in
+ntfs)
+	CLUSTER=4096
+	mkntfs -F -Q -q -s $SECTOR_SIZE -c $CLUSTER -L STRESS "$WORK/target.img"
+	ntfs-3g "$WORK/target.img" "$WORK/mnt"
+	;;
+exfat)
+	# exfatprogs derives the sector size from the device, so 4Kn is only
+	# exercised through the partition table and the other file systems
+	CLUSTER=4096
+	mkfs.exfat -c $CLUSTER -L STRESS "$WORK/target.img" >/dev/null
+	mount.exfat-fuse "$WORK/target.img" "$WORK/mnt"
+	;;
+esac
+mkdir -p "$WORK/mnt/efi/boot"
+populate "$WORK/mnt/efi"
+populate "$WORK/mnt/efi/boot"
+fragment_copy "$PAYLOAD" "$WORK/mnt/efi/boot/boot$ARCH.efi"
+fusermount -u "$WORK/mnt"
+
+# The decoys that precede the target cycle through blank, FAT, NTFS and exFAT
+# partitions, so that the probe has to read and reject each of them before it
+# reaches the target. The NTFS and exFAT ones carry the BitLocker signature,
+# as encrypted volumes do, which is what keeps them from being picked, while
+# the rest of their boot sector and metadata is the real thing.
+mkfs.fat -S $FAT_SECTOR -C "$WORK/decoy1.img" $((DECOY_SIZE * 1024)) >/dev/null
+truncate -s ${DECOY_SIZE}M "$WORK/decoy2.img" "$WORK/decoy3.img"
+mkntfs -F -Q -q -s $SECTOR_SIZE -L DECOY "$WORK/decoy2.img"
+mkfs.exfat -L DECOY "$WORK/decoy3.img" >/dev/null
+cp "$WORK/decoy2.img" "$WORK/ntfs.img"
+cp "$WORK/decoy3.img" "$WORK/exfat.img"
+for d in 2 3; do
+	printf -- '-FVE-FS-' | dd of="$WORK/decoy$d.img" bs=1 seek=3 conv=notrunc status=none
+done
+
+# The partition table, with the ESP first and the target followed by a plain
+# NTFS and a plain exFAT partition, which our drivers may get connected to
+TRAILING=2
+DECOYS=$((PARTITIONS - 2 - TRAILING))
+DISK_SIZE=$((1 + ESP_SIZE + (DECOYS + TRAILING) * DECOY_SIZE + TARGET_SIZE + 1))
+rm -f "$OUTPUT"
+truncate -s ${DISK_SIZE}M "$OUTPUT"
+{
+	echo "label: gpt"
+	echo "sector-size: $SECTOR_SIZE"
+	echo "size=${ESP_SIZE}MiB, type=C12A7328-F81F-11D2-BA4B-00A0C93EC93B"
+	i=0
+	while [ $i -lt $DECOYS ]; do
+		echo "size=${DECOY_SIZE}MiB, type=EBD0A0A2-B9E5-4433-87C0-68B6B72699C7"
+		i=$((i + 1))
+	done
+	echo "size=${TARGET_SIZE}MiB, type=EBD0A0A2-B9E5-4433-87C0-68B6B72699C7"
+	echo "size=${DECOY_SIZE}MiB, type=EBD0A0A2-B9E5-4433-87C0-68B6B72699C7"
+	echo "size=${DECOY_SIZE}MiB, type=EBD0A0A2-B9E5-4433-87C0-68B6B72699C7"
+} | sfdisk -q "$OUTPUT"
+
+OFFSET=1
+dd if="$WORK/esp.img" of="$OUTPUT" bs=1M seek=$OFFSET conv=notrunc status=none
+OFFSET=$((OFFSET + ESP_SIZE))
+i=0
+while [ $i -lt $DECOYS ]; do
+	d=$((i % 4))
+	[ $d -eq 0 ] || dd if="$WORK/decoy$d.img" of="$OUTPUT" bs=1M seek=$OFFSET conv=notrunc status=none
+	OFFSET=$((OFFSET + DECOY_SIZE))
+	i=$((i + 1))
+done
+dd if="$WORK/target.img" of="$OUTPUT" bs=1M seek=$OFFSET conv=notrunc status=none
+OFFSET=$((OFFSET + TARGET_SIZE))
+dd if="$WORK/ntfs.img" of="$OUTPUT" bs=1M seek=$OFFSET conv=notrunc status=none
+OFFSET=$((OFFSET + DECOY_SIZE))
+dd if="$WORK/exfat.img" of="$OUTPUT" bs=1M seek=$OFFSET conv=notrunc status=none
+rm -rf "$WORK"
+
+echo "Created '$OUTPUT' ($PARTITIONS partitions, $SECTOR_SIZE byte sectors, $FS target)"
+echo "To boot it, use something like:"
+echo "  qemu-system-<arch> -bios <firmware> -net none -drive file=$OUTPUT,if=none,format=raw,id=d0 \\"
+echo "    -device virtio-blk-pci,drive=d0,logical_block_size=$SECTOR_SIZE,physical_block_size=$SECTOR_SIZE"
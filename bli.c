@@ -0,0 +1,160 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Boot Loader Interface
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+#include "version.h"
+
+#if !defined(NO_LOADER_INTERFACE)
+
+/* Vendor GUID for the Boot Loader Interface variables */
+#define LOADER_INTERFACE_GUID \
+	{ 0x4a67b082, 0x0a4c, 0x41cf, { 0xb6, 0xc7, 0x44, 0x0b, 0x29, 0xbb, 0x8c, 0x4f } }
+
+#define LOADER_VARIABLE_ATTRIBUTES  (EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+
+/* Prefix of the LoaderInfo we set, to tell our variables from another loader's */
+#define LOADER_INFO_PREFIX          L"UEFI:NTFS"
+
+/*
+ * The Boot Loader Interface from systemd lets the OS find out what boot loader
+ * it was started from, through volatile variables containing NUL terminated
+ * UTF-16 strings. We set the ones that describe us, as well as the times at
+ * which we started and handed over to the target, so that 'systemd-analyze'
+ * can account for UEFI:NTFS when Linux is booted from NTFS or exFAT.
+ * If a boot loader that ran before us set these already, we leave them alone.
+ */
+STATIC EFI_GUID LoaderInterfaceGuid = LOADER_INTERFACE_GUID;
+STATIC BOOLEAN LoaderInterfaceOwned = FALSE;
+
+/*
+ * Set one of the Boot Loader Interface variables to a string.
+ */
+STATIC VOID SetLoaderVariable(CONST CHAR16* Name, CONST CHAR16* Value)
+{
+	EFI_STATUS Status;
+
+	Status = gRT->SetVariable((CHAR16*)Name, &LoaderInterfaceGuid, LOADER_VARIABLE_ATTRIBUTES,
+		StrSize(Value), (VOID*)Value);
+	if (EFI_ERROR(Status))
+		PrintWarning(L"Could not set '%s': %r", Name, Status);
+}
+
+/*
+ * Set one of the Boot Loader Interface variables to a timestamp, which is
+ * expressed in microseconds since the CPU counter was reset.
+ */
+STATIC VOID SetLoaderTime(CONST CHAR16* Name, CONST UINT64 Ticks)
+{
+	CHAR16 Value[24];
+	UINT64 Microseconds = TicksToMicroseconds(Ticks);
+
+	// Don't report a time when we have no counter to measure it with
+	if (Microseconds == 0)
+		return;
+	UnicodeSPrint(Value, sizeof(Value), L"%ld", Microseconds);
+	SetLoaderVariable(Name, Value);
+}
+
+/*
+ * Set LoaderDevicePartUUID from the GPT partition that DeviceHandle is on.
+ */
+STATIC VOID SetLoaderDevicePartUUID(CONST EFI_HANDLE DeviceHandle)
+{
+	EFI_DEVICE_PATH* DevicePath = DevicePathFromHandle(DeviceHandle);
+	HARDDRIVE_DEVICE_PATH* HardDrive;
+	UINT8* Guid;
+	CHAR16 Value[40];
+
+	for (; DevicePath != NULL && !IsDevicePathEnd(DevicePath); DevicePath = NextDevicePathNode(DevicePath)) {
+		if (DevicePathType(DevicePath) != MEDIA_DEVICE_PATH || DevicePathSubType(DevicePath) != MEDIA_HARDDRIVE_DP)
+			continue;
+		HardDrive = (HARDDRIVE_DEVICE_PATH*)DevicePath;
+		// MBR partitions don't have a UUID
+		if (HardDrive->SignatureType != SIGNATURE_TYPE_GUID)
+			return;
+		// The GUID is stored in its mixed endian binary form
+		Guid = HardDrive->Signature;
+		UnicodeSPrint(Value, sizeof(Value), L"%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+			Guid[3], Guid[2], Guid[1], Guid[0], Guid[5], Guid[4], Guid[7], Guid[6],
+			Guid[8], Guid[9], Guid[10], Guid[11], Guid[12], Guid[13], Guid[14], Guid[15]);
+		SetLoaderVariable(L"LoaderDevicePartUUID", Value);
+		return;
+	}
+}
+
+/*
+ * Set LoaderImageIdentifier from the file path nodes of our image's path.
+ */
+STATIC VOID SetLoaderImageIdentifier(CONST EFI_DEVICE_PATH* FilePath)
+{
+	CONST EFI_DEVICE_PATH* DevicePath;
+	CONST CHAR16* Name;
+	CHAR16 Value[PATH_MAX];
+	UINTN i, Length = 0, NameLength;
+
+	for (DevicePath = FilePath; DevicePath != NULL && !IsDevicePathEnd(DevicePath);
+		DevicePath = NextDevicePathNode(DevicePath)) {
+		if (DevicePathType(DevicePath) != MEDIA_DEVICE_PATH || DevicePathSubType(DevicePath) != MEDIA_FILEPATH_DP)
+			continue;
+		Name = (CONST CHAR16*)((CONST UINT8*)DevicePath + OFFSET_OF(FILEPATH_DEVICE_PATH, PathName));
+		NameLength = (DevicePathNodeLength(DevicePath) - OFFSET_OF(FILEPATH_DEVICE_PATH, PathName)) / sizeof(CHAR16);
+		// A path may be split across several nodes
+		if (Length > 0 && Value[Length - 1] != L'\\' && Name[0] != L'\\' && Length < PATH_MAX - 1)
+			Value[Length++] = L'\\';
+		for (i = 0; i < NameLength && Name[i] != 0 && Length < PATH_MAX - 1; i++)
+			Value[Length++] = Name[i];
+	}
+	if (Length == 0)
+		return;
+	Value[Length] = 0;
+	SetLoaderVariable(L"LoaderImageIdentifier", Value);
+}
+
+/*
+ * Set the Boot Loader Interface variables that describe us, along with the
+ * time at which we started, in counter ticks.
+ */
+VOID SetLoaderInterface(CONST EFI_LOADED_IMAGE_PROTOCOL* LoadedImage, CONST UINT64 StartTicks)
+{
+	EFI_STATUS Status;
+	CHAR16 Info[64];
+	UINTN Size = sizeof(Info);
+
+	Status = gRT->GetVariable(L"LoaderInfo", &LoaderInterfaceGuid, NULL, &Size, Info);
+	if (Status != EFI_NOT_FOUND && (Status != EFI_SUCCESS ||
+		StrnCmp(Info, LOADER_INFO_PREFIX, ARRAY_SIZE(LOADER_INFO_PREFIX) - 1) != 0))
+		return;
+	LoaderInterfaceOwned = TRUE;
+
+	UnicodeSPrint(Info, sizeof(Info), L"%s %s", LOADER_INFO_PREFIX, VERSION_STRING);
+	SetLoaderVariable(L"LoaderInfo", Info);
+	SetLoaderTime(L"LoaderTimeInitUSec", StartTicks);
+	SetLoaderDevicePartUUID(LoadedImage->DeviceHandle);
+	SetLoaderImageIdentifier(LoadedImage->FilePath);
+}
+
+/*
+ * Record the time at which we hand over to the target bootloader.
+ */
+VOID SetLoaderExecTime(VOID)
+{
+	if (LoaderInterfaceOwned)
+		SetLoaderTime(L"LoaderTimeExecUSec", GetTimestamp());
+}
+
+#endif /* NO_LOADER_INTERFACE */
@@ -23,7 +23,59 @@
 #include "version.h"
 
 /* Global handle for the current executable */
-STATIC EFI_HANDLE MainImageHandle = NULL;
+EFI_HANDLE MainImageHandle = NULL;
+
+/*
+ * File systems we can chain load from, and the name of their driver. FAT has
+ * no driver of ours, as the firmware services it, and we only chain load from
+ * it in disk images.
+ */
+STATIC CONST struct {
+	CONST CHAR16* Name;
+	CONST CHAR16* DriverName;
+} FileSystem[] = {
+	{ L"NTFS", L"ntfs" },
+	{ L"exFAT", L"exfat" },
+	{ L"ReFS", L"refs" },
+	{ L"UDF", L"udf" },
+	{ L"ext", L"ext2" },
+	{ L"btrfs", L"btrfs" },
+	{ L"FAT", NULL },
+};
+#define FS_NTFS     0
+#define FS_EXFAT    1
+#define FS_REFS     2
+#define FS_UDF      3
+#define FS_EXT      4
+#define FS_BTRFS    5
+#define FS_FAT      6
+#define FS_UNKNOWN  ARRAY_SIZE(FileSystem)
+
+/*
+ * File system probes, that match a magic value at Offset bytes from the start
+ * of the partition. They are tried in order, first against the first block of
+ * the partition, and, if none of those that fit in it matches, against the
+ * first PROBE_SIZE bytes. Probes that would extend past the end of the
+ * partition are skipped.
+ */
+STATIC CONST struct {
+	UINT32 Offset;
+	UINT8 Length;
+	UINT8 Magic[8];
+	UINT8 FsType;
+} FileSystemProbe[] = {
+	// OEM ID of the boot sector
+	{ 0x00003, 8, { 'N', 'T', 'F', 'S', ' ', ' ', ' ', ' ' }, FS_NTFS },
+	{ 0x00003, 8, { 'E', 'X', 'F', 'A', 'T', ' ', ' ', ' ' }, FS_EXFAT },
+	{ 0x00003, 8, { 'R', 'e', 'F', 'S', 0, 0, 0, 0 }, FS_REFS },
+	// NSR descriptor of the Volume Recognition Sequence, for blocks up to 2K and for 4K blocks
+	{ 0x08801, 4, { 'N', 'S', 'R', '0' }, FS_UDF },
+	{ 0x09001, 4, { 'N', 'S', 'R', '0' }, FS_UDF },
+	// Magic of the superblock
+	{ 0x00438, 2, { 0x53, 0xef }, FS_EXT },
+	{ 0x10040, 8, { '_', 'B', 'H', 'R', 'f', 'S', '_', 'M' }, FS_BTRFS },
+};
+#define PROBE_SIZE  (0x10040 + 8)
 
 /* Arch shorthands */
 STATIC CONST struct {
@@ -39,6 +91,19 @@ STATIC CONST struct {
 	{ L"loongarch64", L"64-bit LoongArch", L"a Loong64" },
 };
 
+#if !defined(UEFI_NTFS_DRIVER)
+/* Boot steps that are timed for the dry-run report */
+STATIC CONST CHAR16* StepName[] = {
+	L"Disconnect", L"Scan", L"Direct read", L"Driver", L"Loader",
+};
+#define STEP_DISCONNECT     0
+#define STEP_SCAN           1
+#define STEP_DIRECT_READ    2
+#define STEP_DRIVER         3
+#define STEP_LOADER         4
+STATIC UINT64 StepTicks[ARRAY_SIZE(StepName)] = { 0 };
+#endif
+
 #if defined(_M_X64) || defined(__x86_64__)
   #define ArchIndex 0
 #elif defined(_M_IX86) || defined(__i386__)
@@ -55,28 +120,7 @@ STATIC CONST struct {
 #  error Unsupported architecture
 #endif
 
-/* Get the driver name from a driver handle */
-STATIC CHAR16* GetDriverName(CONST EFI_HANDLE DriverHandle)
-{
-	CHAR16 *DriverName;
-	EFI_COMPONENT_NAME_PROTOCOL *ComponentName;
-	EFI_COMPONENT_NAME2_PROTOCOL *ComponentName2;
-
-	// Try EFI_COMPONENT_NAME2 protocol first
-	if ( (gBS->OpenProtocol(DriverHandle, &gEfiComponentName2ProtocolGuid, (VOID**)&ComponentName2,
-			MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL) == EFI_SUCCESS) &&
-		 (ComponentName2->GetDriverName(ComponentName2, ComponentName2->SupportedLanguages, &DriverName) == EFI_SUCCESS))
-		return DriverName;
-
-	// Fallback to EFI_COMPONENT_NAME if that didn't work
-	if ( (gBS->OpenProtocol(DriverHandle, &gEfiComponentNameProtocolGuid, (VOID**)&ComponentName,
-			MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL) == EFI_SUCCESS) &&
-		 (ComponentName->GetDriverName(ComponentName, ComponentName->SupportedLanguages, &DriverName) == EFI_SUCCESS))
-		return DriverName;
-
-	return L"(unknown driver)";
-}
-
+#if !defined(UEFI_NTFS_DRIVER)
 /*
  * Some UEFI firmwares (like HPQ EFI from HP notebooks) have DiskIo protocols
  * opened BY_DRIVER (by Partition driver in HP's case) even when no file system
@@ -130,13 +174,13 @@ STATIC VOID DisconnectBlockingDrivers(VOID) {
 		Status = gBS->OpenProtocolInformation(Handles[Index], &gEfiDiskIoProtocolGuid, &OpenInfo, &OpenInfoCount);
 		if (EFI_ERROR(Status)) {
 			PrintWarning(L"  Could not get DiskIo protocol for %s: %r", DevicePathString, Status);
-			FreePool(DevicePathString);
+			ArenaFree(DevicePathString);
 			continue;
 		}
 
 		for (OpenInfoIndex = 0; OpenInfoIndex < OpenInfoCount; OpenInfoIndex++) {
 			if ((OpenInfo[OpenInfoIndex].Attributes & EFI_OPEN_PROTOCOL_BY_DRIVER) == EFI_OPEN_PROTOCOL_BY_DRIVER) {
-				Status = gBS->DisconnectController(Handles[Index], OpenInfo[OpenInfoIndex].AgentHandle, NULL);
+				Status = DisconnectDriver(Handles[Index], OpenInfo[OpenInfoIndex].AgentHandle);
 				if (EFI_ERROR(Status)) {
 					PrintErrorStatus(L"  Could not disconnect '%s' on %s",
 						GetDriverName(OpenInfo[OpenInfoIndex].AgentHandle), DevicePathString);
@@ -146,7 +190,7 @@ STATIC VOID DisconnectBlockingDrivers(VOID) {
 				}
 			}
 		}
-		FreePool(DevicePathString);
+		ArenaFree(DevicePathString);
 		FreePool(OpenInfo);
 	}
 	FreePool(Handles);
@@ -174,15 +218,14 @@ STATIC EFI_STATUS UnloadDriver(
 	// bound driver) so try to process them all until we manage to unload a driver.
 	for (i = 0; i < OpenInfoCount; i++) {
 		// Obtain the info of the driver servicing this specific disk instance
-		Status = gBS->OpenProtocol(OpenInfo[i].AgentHandle, &gEfiDriverBindingProtocolGuid,
-			(VOID**)&DriverBinding, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
-		if (EFI_ERROR(Status))
+		DriverBinding = GetDriverBinding(OpenInfo[i].AgentHandle);
+		if (DriverBinding == NULL)
 			continue;
 
 		// Display the driver name and version, then unload it using its image handle
 		DriverName = GetDriverName(OpenInfo[i].AgentHandle);
 		PrintWarning(L"Unloading existing '%s v0x%x'", DriverName, DriverBinding->Version);
-		Status = gBS->UnloadImage(DriverBinding->ImageHandle);
+		Status = UnloadDriverImage(DriverBinding->ImageHandle);
 		if (EFI_ERROR(Status)) {
 			PrintWarning(L"  Could not unload driver: %r", Status);
 			continue;
@@ -193,6 +236,112 @@ STATIC EFI_STATUS UnloadDriver(
 	return EFI_NOT_FOUND;
 }
 
+/*
+ * Get the name and version of the driver that services a file system handle.
+ */
+STATIC CHAR16* GetFileSystemDriver(CONST EFI_HANDLE FileSystemHandle, UINT32* Version)
+{
+	EFI_STATUS Status;
+	UINTN OpenInfoCount, i;
+	EFI_OPEN_PROTOCOL_INFORMATION_ENTRY* OpenInfo;
+	EFI_DRIVER_BINDING_PROTOCOL* DriverBinding;
+	CHAR16* DriverName = NULL;
+
+	Status = gBS->OpenProtocolInformation(FileSystemHandle, &gEfiDiskIoProtocolGuid, &OpenInfo, &OpenInfoCount);
+	if (EFI_ERROR(Status))
+		return NULL;
+
+	for (i = 0; i < OpenInfoCount; i++) {
+		if ((OpenInfo[i].Attributes & EFI_OPEN_PROTOCOL_BY_DRIVER) != EFI_OPEN_PROTOCOL_BY_DRIVER)
+			continue;
+		DriverBinding = GetDriverBinding(OpenInfo[i].AgentHandle);
+		if (DriverBinding == NULL)
+			continue;
+		*Version = DriverBinding->Version;
+		DriverName = GetDriverName(OpenInfo[i].AgentHandle);
+		break;
+	}
+	FreePool(OpenInfo);
+
+	return DriverName;
+}
+
+/*
+ * Check whether we were asked to perform a dry run, either through a
+ * 'dryrun' load option or by pressing 'D' as we are being started.
+ */
+STATIC BOOLEAN IsDryRun(CONST EFI_LOADED_IMAGE_PROTOCOL* LoadedImage)
+{
+	CONST CHAR16 Option[] = L"dryrun";
+	CONST CHAR16* LoadOptions = (CONST CHAR16*)LoadedImage->LoadOptions;
+	UINTN i, j, Len = (LoadOptions == NULL) ? 0 : LoadedImage->LoadOptionsSize / sizeof(CHAR16);
+	EFI_INPUT_KEY Key;
+
+	for (i = 0; i + ARRAY_SIZE(Option) - 1 <= Len; i++) {
+		for (j = 0; (j < ARRAY_SIZE(Option) - 1) && (_tolower(LoadOptions[i + j]) == Option[j]); j++);
+		if (j == ARRAY_SIZE(Option) - 1)
+			return TRUE;
+	}
+
+	return (gST->ConIn->ReadKeyStroke(gST->ConIn, &Key) == EFI_SUCCESS) &&
+		(_tolower(Key.UnicodeChar) == L'd');
+}
+
+#if !defined(NO_DISK_IMAGE)
+/*
+ * Check whether we were asked to boot from a disk image on the target
+ * partition, through an 'image=<path>' load option, and get its path.
+ */
+STATIC BOOLEAN GetDiskImagePath(CONST EFI_LOADED_IMAGE_PROTOCOL* LoadedImage, CHAR16* Path,
+	CONST UINTN Size)
+{
+	CONST CHAR16 Option[] = L"image=";
+	CONST CHAR16* LoadOptions = (CONST CHAR16*)LoadedImage->LoadOptions;
+	UINTN i, j, k, Len = (LoadOptions == NULL) ? 0 : LoadedImage->LoadOptionsSize / sizeof(CHAR16);
+
+	for (i = 0; i + ARRAY_SIZE(Option) - 1 <= Len; i++) {
+		for (j = 0; (j < ARRAY_SIZE(Option) - 1) && (_tolower(LoadOptions[i + j]) == Option[j]); j++);
+		if (j != ARRAY_SIZE(Option) - 1)
+			continue;
+		// The path runs up to the next space, and always starts with a backslash
+		Path[0] = L'\\';
+		k = (LoadOptions[i + j] == L'\\' || LoadOptions[i + j] == L'/') ? 0 : 1;
+		for (i += j; (i < Len) && (LoadOptions[i] != 0) && (LoadOptions[i] != L' ') && (k < Size - 1); i++, k++)
+			Path[k] = (LoadOptions[i] == L'/') ? L'\\' : LoadOptions[i];
+		Path[k] = 0;
+		return (k > 1);
+	}
+	return FALSE;
+}
+#endif
+
+/*
+ * Report what we would have booted and how long it took to get there.
+ */
+STATIC VOID PrintDryRunReport(CONST EFI_HANDLE TargetHandle, CONST UINTN FsType,
+	CONST CHAR16* LoaderPath, CONST BOOLEAN WindowsBootMgr)
+{
+	CHAR16* String;
+	UINT32 Version = 0;
+	UINTN i;
+
+	PrintInfo(L"Dry run report:");
+	String = DevicePathToString(DevicePathFromHandle(TargetHandle));
+	PrintInfo(L"  Target:      %s", (String == NULL) ? L"(unknown)" : String);
+	SafeArenaFree(String);
+	PrintInfo(L"  File system: %s", FileSystem[FsType].Name);
+	String = GetFileSystemDriver(TargetHandle, &Version);
+	if (String != NULL)
+		PrintInfo(L"  Driver:      %s v0x%x", String, Version);
+	else
+		PrintInfo(L"  Driver:      (none)");
+	PrintInfo(L"  Loader:      %s", LoaderPath);
+	PrintInfo(L"  Loader type: %s", WindowsBootMgr ? L"Windows bootmgr" : L"Generic");
+	for (i = 0; i < ARRAY_SIZE(StepName); i++)
+		PrintInfo(L"  %-12s %ld us", StepName[i], TicksToMicroseconds(StepTicks[i]));
+}
+
+#if !defined(NO_BANNER)
 /*
  * Display a centered application banner
  */
@@ -238,244 +387,603 @@ STATIC VOID DisplayBanner(VOID)
 	Print(L"%c\n\n", BOXDRAW_UP_LEFT);
 	DefText();
 }
+#endif
 
 /*
- * Application entry-point
- * NB: This must be set to 'efi_main' for gnu-efi crt0 compatibility
+ * Look for a "bootmgr.dll" string in a loaded image to identify a Windows bootloader.
  */
-EFI_STATUS EFIAPI efi_main(EFI_HANDLE BaseImageHandle, EFI_SYSTEM_TABLE *SystemTable)
+STATIC BOOLEAN IsWindowsBootMgr(CONST EFI_HANDLE ImageHandle)
 {
-	CONST CHAR8 FsMagic[2][8] = {
-		{ 'N', 'T', 'F', 'S', ' ', ' ', ' ', ' '} ,
-		{ 'E', 'X', 'F', 'A', 'T', ' ', ' ', ' '} };
-	CONST CHAR16* FsName[] = { L"NTFS", L"exFAT" };
-	CONST CHAR16* DriverName[] = { L"ntfs", L"exfat" };
-	CHAR16 DriverPath[64], LoaderPath[64], LoaderPath2[64];
-	CHAR16* DevicePathString;
-	EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
-	EFI_STATUS Status;
-	EFI_DEVICE_PATH *DevicePath = NULL, *ParentDevicePath = NULL, *BootDiskPath = NULL;
-	EFI_DEVICE_PATH *BootPartitionPath = NULL;
-	EFI_HANDLE* Handles = NULL, ImageHandle, DriverHandleList[2] = { 0 };
-	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
-	EFI_FILE_SYSTEM_VOLUME_LABEL* VolumeInfo;
-	EFI_FILE_HANDLE Root;
-	EFI_BLOCK_IO_PROTOCOL *BlockIo;
 	// We'll search for "bootmgr.dll" in UEFI bootloaders to identify Windows
 	// bootloaders, but we don't want to match our own bootloader in the process.
 	// So we use a modifiable string buffer where the first character is not set.
 	CHAR8 BootMgrName[] = "_ootmgr.dll", BootMgrNameFirstLetter = 'b';
-	CHAR8* Buffer;
-	INTN SecureBootStatus;
-	UINTN Index, FsType = 0, Try, Event, HandleCount = 0, Size;
-	BOOLEAN SameDevice, WindowsBootMgr = FALSE;
-
-#if defined(_GNU_EFI)
-	InitializeLib(BaseImageHandle, SystemTable);
-#endif
-	MainImageHandle = BaseImageHandle;
-
-	DisplayBanner();
-	PrintSystemInfo();
-	SecureBootStatus = GetSecureBootStatus();
-	SetText(TEXT_WHITE);
-	Print(L"[INFO]");
-	DefText();
-	Print(L" Secure Boot status: ");
-	if (SecureBootStatus == 0) {
-		Print(L"Disabled\n");
-	} else {
-		SetText((SecureBootStatus > 0) ? TEXT_WHITE : TEXT_YELLOW);
-		Print(L"%s\n", (SecureBootStatus > 0) ? L"Enabled" : L"Setup");
-		DefText();
-	}
+	EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+	EFI_STATUS Status;
 
-	Status = gBS->OpenProtocol(MainImageHandle, &gEfiLoadedImageProtocolGuid,
+	BootMgrName[0] = BootMgrNameFirstLetter;
+	Status = gBS->OpenProtocol(ImageHandle, &gEfiLoadedImageProtocolGuid,
 		(VOID**)&LoadedImage, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
 	if (EFI_ERROR(Status)) {
-		PrintErrorStatus(L"Unable to access boot image interface");
-		goto out;
+		PrintWarning(L"  Unable to inspect loaded executable");
+		return FALSE;
 	}
+	if (LoadedImage->ImageSize <= 0x40)
+		return FALSE;
+	return (FindMem((CHAR8*)((UINTN)LoadedImage->ImageBase + 0x40), (UINTN)LoadedImage->ImageSize - 0x40,
+		BootMgrName, sizeof(BootMgrName)) != NULL);
+}
+#endif
 
-	PrintInfo(L"Disconnecting potentially blocking drivers");
-	DisconnectBlockingDrivers();
+/*
+ * Check the fields of an ext superblock that we can validate without knowing
+ * its features, so that a stray 0xEF53 isn't taken for an ext file system.
+ */
+STATIC BOOLEAN IsValidExtSuperblock(CONST UINT8* Buffer)
+{
+	UINT32 LogBlockSize, BlocksPerGroup, InodesPerGroup, Revision;
 
-	// Identify our boot partition and disk
-	BootPartitionPath = DevicePathFromHandle(LoadedImage->DeviceHandle);
-	BootDiskPath = GetParentDevice(BootPartitionPath);
+	CopyMem(&LogBlockSize, &Buffer[0x418], sizeof(UINT32));
+	CopyMem(&BlocksPerGroup, &Buffer[0x420], sizeof(UINT32));
+	CopyMem(&InodesPerGroup, &Buffer[0x428], sizeof(UINT32));
+	CopyMem(&Revision, &Buffer[0x44C], sizeof(UINT32));
+	// Blocks are 1K to 64K, and there are only two revisions
+	return (LogBlockSize <= 6) && (BlocksPerGroup != 0) && (InodesPerGroup != 0) && (Revision <= 1);
+}
 
-	PrintInfo(L"Searching for target partition on boot disk:");
-	DevicePathString = DevicePathToString(BootDiskPath);
-	PrintInfo(L"  %s", DevicePathString);
-	SafeFree(DevicePathString);
-	// Enumerate all disk handles
-	Status = gBS->LocateHandleBuffer(ByProtocol, &gEfiDiskIoProtocolGuid,
-		NULL, &HandleCount, &Handles);
-	if (EFI_ERROR(Status)) {
-		PrintErrorStatus(L"  Failed to list disks");
-		goto out;
-	}
+/*
+ * Match the probes that end after Start bytes and within Size bytes of Buffer.
+ */
+STATIC UINTN MatchFileSystemProbes(CONST UINT8* Buffer, CONST UINTN Start, CONST UINTN Size)
+{
+	UINTN i, End;
 
-	// Go through the partitions and find the one that has the USB Disk we booted from
-	// as parent and that isn't the FAT32 boot partition
-	for (Index = 0; Index < HandleCount; Index++) {
-		// Note: The Device Path obtained from DevicePathFromHandle() should NOT be freed!
-		DevicePath = DevicePathFromHandle(Handles[Index]);
-		// Eliminate the partition we booted from
-		if (CompareDevicePaths(DevicePath, BootPartitionPath) == 0)
-			continue;
-		// Ensure that we look for the NTFS/exFAT partition on the same device.
-		ParentDevicePath = GetParentDevice(DevicePath);
-		SameDevice = (CompareDevicePaths(BootDiskPath, ParentDevicePath) == 0);
-		SafeFree(ParentDevicePath);
-		// The check breaks QEMU testing (since we can't easily emulate
-		// a multipart device on the fly) so only do it for release.
-#if !defined(_DEBUG)
-		if (!SameDevice)
-			continue;
-#else
-		(VOID)SameDevice;	// Silence a MinGW warning
-#endif
-		// Read the first block of the partition and look for the FS magic in the OEM ID
-		Status = gBS->OpenProtocol(Handles[Index], &gEfiBlockIoProtocolGuid,
-			(VOID**)&BlockIo, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
-		if (EFI_ERROR(Status))
+	for (i = 0; i < ARRAY_SIZE(FileSystemProbe); i++) {
+		End = FileSystemProbe[i].Offset + FileSystemProbe[i].Length;
+		if ((End <= Start) || (End > Size))
 			continue;
-		Buffer = (CHAR8*)AllocatePool(BlockIo->Media->BlockSize);
-		if (Buffer == NULL)
+		if (CompareMem(&Buffer[FileSystemProbe[i].Offset], FileSystemProbe[i].Magic,
+			FileSystemProbe[i].Length) != 0)
 			continue;
-		Status = BlockIo->ReadBlocks(BlockIo, BlockIo->Media->MediaId, 0, BlockIo->Media->BlockSize, Buffer);
-		for (FsType = 0; (FsType < ARRAY_SIZE(FsName)) && 
-			(CompareMem(&Buffer[3], FsMagic[FsType], sizeof(FsMagic[FsType])) != 0); FsType++);
-		FreePool(Buffer);
-		if (EFI_ERROR(Status))
+		if ((FileSystemProbe[i].FsType == FS_EXT) && !IsValidExtSuperblock(Buffer))
 			continue;
-		if (FsType < ARRAY_SIZE(FsName))
-			break;
+		return FileSystemProbe[i].FsType;
 	}
+	return FS_UNKNOWN;
+}
 
-	if (Index >= HandleCount) {
-		Status = EFI_NOT_FOUND;
-		PrintErrorStatus(L"  Could not locate target partition");
+/*
+ * Identify the file system of a partition. Most partitions can be identified
+ * from their first block, so we only read the first PROBE_SIZE bytes if that
+ * isn't the case. If FirstBlock is not NULL, the first block of the partition
+ * is copied there. Returns FS_UNKNOWN if no file system we support was found.
+ */
+STATIC UINTN ProbeFileSystem(EFI_BLOCK_IO_PROTOCOL* BlockIo, VOID* FirstBlock)
+{
+	EFI_STATUS Status;
+	EFI_PHYSICAL_ADDRESS Address;
+	CONST UINT8* Buffer;
+	UINT64 MediaSize;
+	UINTN Size, BlockSize = BlockIo->Media->BlockSize, FsType = FS_UNKNOWN;
+
+	if (BlockSize == 0)
+		return FS_UNKNOWN;
+	// Round up to the block size, without reading past the end of the media
+	Size = ((PROBE_SIZE + BlockSize - 1) / BlockSize) * BlockSize;
+	MediaSize = MultU64x32(BlockIo->Media->LastBlock + 1, (UINT32)BlockSize);
+	if (MediaSize < Size)
+		Size = (UINTN)MediaSize;
+	if (Size == 0)
+		return FS_UNKNOWN;
+
+	// Pages are aligned enough for any IoAlign the media may require
+	Status = gBS->AllocatePages(AllocateAnyPages, EfiBootServicesData, EFI_SIZE_TO_PAGES(Size), &Address);
+	if (EFI_ERROR(Status))
+		return FS_UNKNOWN;
+	Buffer = (CONST UINT8*)(UINTN)Address;
+	Status = BlockIo->ReadBlocks(BlockIo, BlockIo->Media->MediaId, 0, BlockSize, (VOID*)Buffer);
+	if (EFI_ERROR(Status))
 		goto out;
+	if (FirstBlock != NULL)
+		CopyMem(FirstBlock, Buffer, BlockSize);
+
+	FsType = MatchFileSystemProbes(Buffer, 0, BlockSize);
+	if ((FsType == FS_UNKNOWN) && (Size > BlockSize)) {
+		Status = BlockIo->ReadBlocks(BlockIo, BlockIo->Media->MediaId, 0, Size, (VOID*)Buffer);
+		if (!EFI_ERROR(Status))
+			FsType = MatchFileSystemProbes(Buffer, BlockSize, Size);
 	}
-	PrintInfo(L"Found %s target partition:", FsName[FsType]);
-	DevicePathString = DevicePathToString(DevicePath);
-	PrintInfo(L"  %s", DevicePathString);
-	SafeFree(DevicePathString);
 
-	// Test for presence of file system protocol (to see if there already is
-	// a filesystem driver servicing this partition)
-	Status = gBS->OpenProtocol(Handles[Index], &gEfiSimpleFileSystemProtocolGuid,
-		(VOID**)&Volume, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_TEST_PROTOCOL);
+out:
+	gBS->FreePages(Address, EFI_SIZE_TO_PAGES(Size));
+	return FsType;
+}
 
-	// Only handle partitions that are flagged as serviced or needing service
-	if (Status != EFI_SUCCESS && Status != EFI_UNSUPPORTED) {
-		PrintErrorStatus(L"Could not check for %s service", FsName[FsType]);
-		goto out;
+/*
+ * Get the path of file system driver Candidate for FsType on our boot device.
+ * Candidate 0 is the default driver, and the others are alternatives to it.
+ */
+STATIC VOID GetFileSystemDriverPath(CONST UINTN FsType, CONST UINTN Candidate, CHAR16* DriverPath,
+	CONST UINTN Size)
+{
+	// Use 'rufus' in the driver path, so that we don't accidentally latch onto a user driver
+	if (Candidate == 0)
+		UnicodeSPrint(DriverPath, Size, L"\\efi\\rufus\\%s_%s.efi",
+			FileSystem[FsType].DriverName, Arch[ArchIndex].EfiSuffix);
+	else
+		UnicodeSPrint(DriverPath, Size, L"\\efi\\rufus\\%s_%s_%d.efi",
+			FileSystem[FsType].DriverName, Arch[ArchIndex].EfiSuffix, Candidate);
+}
+
+/*
+ * Load and start file system driver Candidate for FsType from our boot device.
+ */
+STATIC EFI_STATUS LoadFileSystemDriver(CONST UINTN FsType, CONST UINTN Candidate,
+	CONST EFI_HANDLE BootDeviceHandle, CONST INTN SecureBootStatus, EFI_HANDLE* ImageHandle)
+{
+	CHAR16 DriverPath[64];
+	EFI_STATUS Status;
+	EFI_DEVICE_PATH *DevicePath;
+	EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+	VOID* Buffer = NULL;
+	UINTN Size = 0;
+
+	GetFileSystemDriverPath(FsType, Candidate, DriverPath, ARRAY_SIZE(DriverPath));
+	DevicePath = FileDevicePath(BootDeviceHandle, DriverPath);
+	if (DevicePath == NULL) {
+		Status = EFI_DEVICE_ERROR;
+		PrintErrorStatus(L"  Unable to set path for '%s'", DriverPath);
+		return Status;
 	}
 
-	// Because of the AMI NTFS driver bug (https://github.com/pbatard/AmiNtfsBug) as
-	// well as reports of issues when using an NTFS driver different from ours, we
-	// unconditionally try to unload any native file system driver that is servicing
-	// our target partition.
-	if (Status == EFI_SUCCESS) {
-		// Unload the driver and, if successful, flag the partition as needing service
-		if (UnloadDriver(Handles[Index]) == EFI_SUCCESS)
-			Status = EFI_UNSUPPORTED;
+	// Attempt to load the driver.
+	// NB: If running in a Secure Boot enabled environment, LoadImage() will fail if
+	// the image being loaded does not pass the Secure Boot signature validation.
+	// If we already read the driver in the background, it is loaded from memory.
+#if !defined(NO_PREFETCH)
+	Buffer = GetPrefetchedFile(DriverPath, &Size);
+#endif
+	Status = gBS->LoadImage(FALSE, MainImageHandle, DevicePath, Buffer, Size, ImageHandle);
+	SafeFree(DevicePath);
+	if (Buffer != NULL)
+		SafeFree(Buffer);
+	if (EFI_ERROR(Status)) {
+		// Some platforms (e.g. Intel NUCs) return EFI_ACCESS_DENIED for Secure Boot
+		// validation errors. Return a much more explicit EFI_SECURITY_VIOLATION then.
+		if ((Status == EFI_ACCESS_DENIED) && (SecureBootStatus >= 1))
+			Status = EFI_SECURITY_VIOLATION;
+		PrintErrorStatus(L"  Unable to load driver '%s'", DriverPath);
+		return Status;
 	}
 
-	// If the partition is not/no-longer serviced, start our file system driver.
-	if (Status == EFI_UNSUPPORTED) {
-		PrintInfo(L"Starting %s driver service:", FsName[FsType]);
-
-		// Use 'rufus' in the driver path, so that we don't accidentally latch onto a user driver
-		UnicodeSPrint(DriverPath, ARRAY_SIZE(DriverPath), L"\\efi\\rufus\\%s_%s.efi", DriverName[FsType], Arch[ArchIndex].EfiSuffix);
-		DevicePath = FileDevicePath(LoadedImage->DeviceHandle, DriverPath);
-		if (DevicePath == NULL) {
-			Status = EFI_DEVICE_ERROR;
-			PrintErrorStatus(L"  Unable to set path for '%s'", DriverPath);
-			goto out;
-		}
+	// NB: Some HP firmwares refuse to start drivers that are not of type 'EFI Boot
+	// System Driver'. For instance, a driver of type 'EFI Runtime Driver' produces
+	// a 'Load Error' on StartImage() with these firmwares => check the type.
+	Status = gBS->OpenProtocol(*ImageHandle, &gEfiLoadedImageProtocolGuid,
+		(VOID**)&LoadedImage, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (EFI_ERROR(Status)) {
+		PrintErrorStatus(L"  Unable to access driver interface");
+		return Status;
+	}
+	if (LoadedImage->ImageCodeType != EfiBootServicesCode) {
+		Status = EFI_LOAD_ERROR;
+		PrintErrorStatus(L"  '%s' is not a Boot System Driver", DriverPath);
+		return Status;
+	}
 
-		// Attempt to load the driver.
-		// NB: If running in a Secure Boot enabled environment, LoadImage() will fail if
-		// the image being loaded does not pass the Secure Boot signature validation.
-		Status = gBS->LoadImage(FALSE, MainImageHandle, DevicePath, NULL, 0, &ImageHandle);
-		SafeFree(DevicePath);
-		if (EFI_ERROR(Status)) {
-			// Some platforms (e.g. Intel NUCs) return EFI_ACCESS_DENIED for Secure Boot
-			// validation errors. Return a much more explicit EFI_SECURITY_VIOLATION then.
-			if ((Status == EFI_ACCESS_DENIED) && (SecureBootStatus >= 1))
-				Status = EFI_SECURITY_VIOLATION;
-			PrintErrorStatus(L"  Unable to load driver '%s'", DriverPath);
-			goto out;
-		}
+	// Load was a success - attempt to start the driver
+	Status = gBS->StartImage(*ImageHandle, NULL, NULL);
+	if (EFI_ERROR(Status)) {
+		PrintErrorStatus(L"  Unable to start driver");
+		return Status;
+	}
+	PrintInfo(L"  %s", GetDriverName(*ImageHandle));
 
-		// NB: Some HP firmwares refuse to start drivers that are not of type 'EFI Boot
-		// System Driver'. For instance, a driver of type 'EFI Runtime Driver' produces
-		// a 'Load Error' on StartImage() with these firmwares => check the type.
-		Status = gBS->OpenProtocol(ImageHandle, &gEfiLoadedImageProtocolGuid,
-			(VOID**)&LoadedImage, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
-		if (EFI_ERROR(Status)) {
-			PrintErrorStatus(L"  Unable to access driver interface");
-			goto out;
-		}
-		if (LoadedImage->ImageCodeType != EfiBootServicesCode) {
-			Status = EFI_LOAD_ERROR;
-			PrintErrorStatus(L"  '%s' is not a Boot System Driver", DriverPath);
-			goto out;
-		}
+	return EFI_SUCCESS;
+}
 
-		// Load was a success - attempt to start the driver
-		Status = gBS->StartImage(ImageHandle, NULL, NULL);
-		if (EFI_ERROR(Status)) {
-			PrintErrorStatus(L"  Unable to start driver");
-			goto out;
-		}
-		PrintInfo(L"  %s", GetDriverName(ImageHandle));
 
-		// Calling ConnectController() on a handle, with a NULL-terminated list of
-		// drivers will start all the drivers from the list that can service it
-		DriverHandleList[0] = ImageHandle;
-		DriverHandleList[1] = NULL;
-		Status = gBS->ConnectController(Handles[Index], DriverHandleList, NULL, TRUE);
-		if (EFI_ERROR(Status)) {
-			PrintErrorStatus(L"  Could not start %s partition service", FsName[FsType]);
-			goto out;
-		}
+#if !defined(NO_PREFETCH) && !defined(UEFI_NTFS_DRIVER)
+/*
+ * Start reading the default NTFS and exFAT drivers from our boot device, since
+ * we are most likely to need one of them once we have found the target. Both
+ * are a few hundred KB, so reading the one we won't need costs little, and
+ * this lets the reads overlap with the driver disconnection and the scan.
+ */
+STATIC VOID PrefetchFileSystemDrivers(CONST EFI_HANDLE BootDeviceHandle)
+{
+	CONST UINTN FsTypes[] = { FS_NTFS, FS_EXFAT };
+	CHAR16 DriverPath[64];
+	UINTN i;
+
+	for (i = 0; i < ARRAY_SIZE(FsTypes); i++) {
+		GetFileSystemDriverPath(FsTypes[i], 0, DriverPath, ARRAY_SIZE(DriverPath));
+		StartPrefetch(BootDeviceHandle, DriverPath);
 	}
+}
+#endif
 
-	// Our target file system is case sensitive, so we need to figure out the
-	// case sensitive version of the following
-	UnicodeSPrint(LoaderPath, ARRAY_SIZE(LoaderPath), L"\\efi\\boot\\boot%s.efi", Arch[ArchIndex].EfiSuffix);
+/*
+ * Connect our file system driver to the target partition. A non-recursive
+ * connect is all our driver needs to produce the file system, and avoids
+ * pulling in unrelated child drivers, so we only escalate to a recursive
+ * connect if the file system didn't appear.
+ */
+STATIC EFI_STATUS ConnectFileSystemDriver(CONST EFI_HANDLE TargetHandle, CONST EFI_HANDLE DriverHandle)
+{
+	EFI_STATUS Status;
+	EFI_HANDLE DriverHandleList[2];
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	UINT32 Quirks = GetFirmwareQuirks();
+	UINT64 Start;
 
-	PrintInfo(L"Opening target %s partition:", FsName[FsType]);
-	// Open the the volume, with retry, as we may need to wait before poking
-	// at the FS content, in case the system is slow to start our service...
-	for (Try = 0; ; Try++) {
-		Status = gBS->OpenProtocol(Handles[Index], &gEfiSimpleFileSystemProtocolGuid,
-			(VOID**)&Volume, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL);
+	// Calling ConnectController() on a handle, with a NULL-terminated list of
+	// drivers will start all the drivers from the list that can service it
+	DriverHandleList[0] = DriverHandle;
+	DriverHandleList[1] = NULL;
+
+	if (!(Quirks & QUIRK_RECURSIVE_CONNECT)) {
+		Start = GetTimestamp();
+		Status = gBS->ConnectController(TargetHandle, DriverHandleList, NULL, FALSE);
 		if (!EFI_ERROR(Status))
-			break;
-		PrintErrorStatus(L"  Could not open partition");
-		if (Try >= NUM_RETRIES)
-			goto out;
-		PrintWarning(L"  Waiting %d seconds before retrying...", DELAY);
-		gBS->Stall(DELAY * 1000000);
+			Status = gBS->OpenProtocol(TargetHandle, &gEfiSimpleFileSystemProtocolGuid,
+				(VOID**)&Volume, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_TEST_PROTOCOL);
+		PrintInfo(L"  Non-recursive connect: %r (%ld us)", Status, TicksToMicroseconds(GetTimestamp() - Start));
+		if (!EFI_ERROR(Status) || (Quirks & QUIRK_NON_RECURSIVE_CONNECT))
+			return Status;
 	}
 
-	// Open the root directory
-	Root = NULL;
-	Status = Volume->OpenVolume(Volume, &Root);
-	if ((EFI_ERROR(Status)) || (Root == NULL)) {
-		PrintErrorStatus(L"  Could not open Root directory");
-		goto out;
-	}
+	Start = GetTimestamp();
+	Status = gBS->ConnectController(TargetHandle, DriverHandleList, NULL, TRUE);
+	PrintInfo(L"  Recursive connect: %r (%ld us)", Status, TicksToMicroseconds(GetTimestamp() - Start));
+	return Status;
+}
 
-	// Get the volume label while we're at it
+#if !defined(UEFI_NTFS_DRIVER)
+#if !defined(NO_DRIVER_SELECTION)
+/* Maximum number of drivers we consider for each file system */
+#define MAX_DRIVER_CANDIDATES   4
+
+/* How much of the bootloader we read, when measuring a driver */
+#define DRIVER_BENCHMARK_SIZE   (1024 * 1024)
+
+/*
+ * Besides the default file system driver, \efi\rufus\ can contain alternatives
+ * to it, named <fs>_<arch>_1.efi, <fs>_<arch>_2.efi and so on (for instance,
+ * different efifs builds), since how well a driver performs depends a lot on
+ * the block layer of the firmware. When there are alternatives, we measure how
+ * long each one takes to mount the target and read the start of the bootloader,
+ * and record the fastest, along with the SMBIOS product it was measured on, in
+ * an NV variable, so that subsequent boots can load it directly.
+ */
+typedef struct {
+	UINT32 Candidate;
+	UINT32 CandidateCount;
+	CHAR8 Product[64];
+} DRIVER_SELECTION;
+
+/*
+ * Get the name of the variable we record the driver selection for FsType in.
+ */
+STATIC VOID GetDriverSelectionName(CONST UINTN FsType, CHAR16* Name, CONST UINTN Size)
+{
+	UnicodeSPrint(Name, Size, L"%sDriver", FileSystem[FsType].Name);
+}
+
+/*
+ * Count the driver candidates we have for FsType on our boot device.
+ */
+STATIC UINTN CountFileSystemDrivers(CONST UINTN FsType, CONST EFI_HANDLE BootDeviceHandle)
+{
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	EFI_FILE_HANDLE Root, File;
+	CHAR16 DriverPath[64];
+	UINTN Count;
+
+	if ((gBS->OpenProtocol(BootDeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Volume,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL) != EFI_SUCCESS) ||
+		(Volume->OpenVolume(Volume, &Root) != EFI_SUCCESS))
+		return 1;
+	// The alternatives must be numbered sequentially
+	for (Count = 1; Count < MAX_DRIVER_CANDIDATES; Count++) {
+		GetFileSystemDriverPath(FsType, Count, DriverPath, ARRAY_SIZE(DriverPath));
+		if (Root->Open(Root, &File, DriverPath, EFI_FILE_MODE_READ, 0) != EFI_SUCCESS)
+			break;
+		File->Close(File);
+	}
+	Root->Close(Root);
+	return Count;
+}
+
+/*
+ * Load driver Candidate for FsType, and measure how long it takes to mount the
+ * target partition and read the start of the bootloader. On success, the driver
+ * is left loaded but disconnected, unless we return EFI_ALREADY_STARTED, which
+ * means that the driver could not be disconnected from the target.
+ */
+STATIC EFI_STATUS MeasureFileSystemDriver(CONST EFI_HANDLE TargetHandle, CONST UINTN FsType,
+	CONST UINTN Candidate, CONST EFI_HANDLE BootDeviceHandle, CONST INTN SecureBootStatus,
+	CONST CHAR16* LoaderPath, EFI_HANDLE* ImageHandle, UINT64* Ticks)
+{
+	EFI_STATUS Status;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	EFI_FILE_HANDLE Root = NULL, File = NULL;
+	CHAR16* Path = NULL;
+	UINT8* Buffer = NULL;
+	UINTN Size = DRIVER_BENCHMARK_SIZE;
+	UINT64 Start = GetTimestamp();
+
+	*ImageHandle = NULL;
+	*Ticks = 0;
+	Status = LoadFileSystemDriver(FsType, Candidate, BootDeviceHandle, SecureBootStatus, ImageHandle);
+	if (EFI_ERROR(Status))
+		return Status;
+
+	Status = ConnectFileSystemDriver(TargetHandle, *ImageHandle);
+	if (!EFI_ERROR(Status))
+		Status = gBS->OpenProtocol(TargetHandle, &gEfiSimpleFileSystemProtocolGuid,
+			(VOID**)&Volume, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (!EFI_ERROR(Status))
+		Status = Volume->OpenVolume(Volume, &Root);
+	if (!EFI_ERROR(Status)) {
+		// SetPathCase() corrects the case in place, and LoaderPath is shared by all candidates
+		Path = ArenaAllocate(StrSize(LoaderPath));
+		if (Path == NULL) {
+			Status = EFI_OUT_OF_RESOURCES;
+		} else {
+			CopyMem(Path, LoaderPath, StrSize(LoaderPath));
+			Status = SetPathCase(Root, Path);
+		}
+	}
+	if (!EFI_ERROR(Status))
+		Status = Root->Open(Root, &File, Path, EFI_FILE_MODE_READ, 0);
+	if (!EFI_ERROR(Status)) {
+		Buffer = ArenaAllocate(Size);
+		Status = (Buffer == NULL) ? EFI_OUT_OF_RESOURCES : File->Read(File, &Size, Buffer);
+	}
+	*Ticks = GetTimestamp() - Start;
+
+	if (File != NULL)
+		File->Close(File);
+	if (Root != NULL)
+		Root->Close(Root);
+	SafeArenaFree(Buffer);
+	SafeArenaFree(Path);
+
+	// Free the target for the next candidate
+	if ((DisconnectDriver(TargetHandle, *ImageHandle) != EFI_SUCCESS) && !EFI_ERROR(Status))
+		Status = EFI_ALREADY_STARTED;
+	return Status;
+}
+
+/*
+ * Pick the file system driver for FsType, measuring the candidates if we have
+ * more than one, and haven't done so on this platform yet. Returns the handle
+ * of the selected driver if it was left running on the target, or NULL if
+ * driver *Candidate still needs to be loaded.
+ */
+STATIC EFI_HANDLE SelectFileSystemDriver(CONST EFI_HANDLE TargetHandle, CONST UINTN FsType,
+	CONST EFI_HANDLE BootDeviceHandle, CONST INTN SecureBootStatus, CONST CHAR16* LoaderPath,
+	UINTN* Candidate)
+{
+	EFI_STATUS Status;
+	DRIVER_SELECTION Selection, Recorded;
+	CONST CHAR8* Product = GetPlatformName();
+	CHAR16 VariableName[32];
+	EFI_HANDLE ImageHandle, BestImageHandle = NULL;
+	UINT64 Ticks, BestTicks = 0;
+	UINTN i, Count, Size = sizeof(Recorded);
+
+	*Candidate = 0;
+	Count = CountFileSystemDrivers(FsType, BootDeviceHandle);
+	if (Count <= 1)
+		return NULL;
+
+	ZeroMem(&Selection, sizeof(Selection));
+	Selection.CandidateCount = (UINT32)Count;
+	for (i = 0; (Product != NULL) && (Product[i] != 0) && (i < sizeof(Selection.Product) - 1); i++)
+		Selection.Product[i] = Product[i];
+
+	// Use the driver we selected before, if the platform and candidates haven't changed
+	GetDriverSelectionName(FsType, VariableName, sizeof(VariableName));
+	if ((gRT->GetVariable(VariableName, &gUefiNtfsVariableGuid, NULL, &Size, &Recorded) == EFI_SUCCESS) &&
+		(Size == sizeof(Recorded)) && (Recorded.CandidateCount == Count) && (Recorded.Candidate < Count) &&
+		(CompareMem(Recorded.Product, Selection.Product, sizeof(Selection.Product)) == 0)) {
+		*Candidate = Recorded.Candidate;
+		PrintInfo(L"  Using driver %d of %d, as selected for this platform", *Candidate, Count);
+		return NULL;
+	}
+
+	PrintInfo(L"  Measuring %d drivers", Count);
+#if !defined(NO_PREFETCH)
+	// Load all the candidates from the media, so that they are measured on equal terms
+	StopPrefetch();
+#endif
+	for (i = 0; i < Count; i++) {
+		Status = MeasureFileSystemDriver(TargetHandle, FsType, i, BootDeviceHandle, SecureBootStatus,
+			LoaderPath, &ImageHandle, &Ticks);
+		PrintInfo(L"  Driver %d: %r (%ld us)", i, Status, TicksToMicroseconds(Ticks));
+		if (Status == EFI_ALREADY_STARTED) {
+			// We can't measure any other driver, so use this one without recording it
+			if (BestImageHandle != NULL)
+				UnloadDriverImage(BestImageHandle);
+			*Candidate = i;
+			return ImageHandle;
+		}
+		if (EFI_ERROR(Status) || ((BestImageHandle != NULL) && (Ticks >= BestTicks))) {
+			if (ImageHandle != NULL)
+				UnloadDriverImage(ImageHandle);
+			continue;
+		}
+		if (BestImageHandle != NULL)
+			UnloadDriverImage(BestImageHandle);
+		BestImageHandle = ImageHandle;
+		BestTicks = Ticks;
+		*Candidate = i;
+	}
+	// If none of them worked, let the regular process report the error
+	if (BestImageHandle == NULL)
+		return NULL;
+
+	Selection.Candidate = (UINT32)*Candidate;
+	Status = gRT->SetVariable(VariableName, &gUefiNtfsVariableGuid, EFI_VARIABLE_NON_VOLATILE |
+		EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS, sizeof(Selection), &Selection);
+	if (EFI_ERROR(Status))
+		PrintWarning(L"  Could not record the driver selection: %r", Status);
+
+	// The driver we selected is still loaded, so we only need to reconnect it
+	PrintInfo(L"  Selected driver %d", *Candidate);
+	if (EFI_ERROR(ConnectFileSystemDriver(TargetHandle, BestImageHandle))) {
+		UnloadDriverImage(BestImageHandle);
+		return NULL;
+	}
+	return BestImageHandle;
+}
+
+/*
+ * Forget the driver we selected for FsType, so that we measure them again.
+ */
+STATIC VOID ClearDriverSelection(CONST UINTN FsType)
+{
+	CHAR16 VariableName[32];
+
+	GetDriverSelectionName(FsType, VariableName, sizeof(VariableName));
+	gRT->SetVariable(VariableName, &gUefiNtfsVariableGuid, 0, 0, NULL);
+}
+#endif
+
+/* Candidate value for a partition that is serviced without any of our drivers */
+#define NO_DRIVER_CANDIDATE     ((UINTN)-1)
+
+/*
+ * Start our file system driver service on the target partition, after
+ * unloading any native driver that may already be servicing it.
+ * Candidate is set to the driver we used, or NO_DRIVER_CANDIDATE if the
+ * partition is serviced by a driver that isn't ours.
+ */
+STATIC EFI_STATUS StartDriverService(CONST EFI_HANDLE TargetHandle, CONST UINTN FsType,
+	CONST EFI_HANDLE BootDeviceHandle, CONST INTN SecureBootStatus, CONST CHAR16* LoaderPath,
+	UINTN* Candidate)
+{
+	EFI_STATUS Status;
+	EFI_HANDLE ImageHandle;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+
+	*Candidate = NO_DRIVER_CANDIDATE;
+
+	// Test for presence of file system protocol (to see if there already is
+	// a filesystem driver servicing this partition)
+	Status = gBS->OpenProtocol(TargetHandle, &gEfiSimpleFileSystemProtocolGuid,
+		(VOID**)&Volume, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_TEST_PROTOCOL);
+
+	// Only handle partitions that are flagged as serviced or needing service
+	if (Status != EFI_SUCCESS && Status != EFI_UNSUPPORTED) {
+		PrintErrorStatus(L"Could not check for %s service", FileSystem[FsType].Name);
+		return Status;
+	}
+
+	// Because of the AMI NTFS driver bug (https://github.com/pbatard/AmiNtfsBug) as
+	// well as reports of issues when using an NTFS driver different from ours, we
+	// try to unload any native file system driver that is servicing our target
+	// partition, on the platforms that are known to need it.
+	if ((Status == EFI_SUCCESS) && (GetFirmwareQuirks() & QUIRK_UNLOAD_NATIVE_DRIVER)) {
+		// Unload the driver and, if successful, flag the partition as needing service
+		if (UnloadDriver(TargetHandle) == EFI_SUCCESS)
+			Status = EFI_UNSUPPORTED;
+	}
+
+	// If the partition is still serviced, there's nothing else we need to do
+	if (Status != EFI_UNSUPPORTED)
+		return EFI_SUCCESS;
+
+	PrintInfo(L"Starting %s driver service:", FileSystem[FsType].Name);
+	*Candidate = 0;
+#if !defined(NO_DRIVER_SELECTION)
+	if (SelectFileSystemDriver(TargetHandle, FsType, BootDeviceHandle, SecureBootStatus,
+		LoaderPath, Candidate) != NULL)
+		return EFI_SUCCESS;
+#endif
+	Status = LoadFileSystemDriver(FsType, *Candidate, BootDeviceHandle, SecureBootStatus, &ImageHandle);
+	if (!EFI_ERROR(Status)) {
+		Status = ConnectFileSystemDriver(TargetHandle, ImageHandle);
+		if (EFI_ERROR(Status))
+			PrintErrorStatus(L"  Could not start %s partition service", FileSystem[FsType].Name);
+	}
+
+#if !defined(NO_DRIVER_SELECTION)
+	// If the driver we selected no longer works, measure them again next time
+	if (EFI_ERROR(Status) && (*Candidate != 0))
+		ClearDriverSelection(FsType);
+#endif
+	return Status;
+}
+
+/*
+ * Queue the boot options that let the firmware boot LoaderPath directly, with
+ * file system driver Candidate, if we had to start one. If we didn't, which
+ * is also the case when we read an exFAT bootloader ourselves or when our
+ * driver failed, the firmware can only boot the target if it has a native
+ * driver servicing it.
+ */
+STATIC VOID PrepareDirectBoot(CONST EFI_HANDLE BootDeviceHandle, CONST EFI_HANDLE TargetHandle,
+	CONST UINTN FsType, CONST UINTN Candidate, CONST CHAR16* LoaderPath)
+{
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	CHAR16 DriverPath[64];
+
+	if (Candidate != NO_DRIVER_CANDIDATE)
+		GetFileSystemDriverPath(FsType, Candidate, DriverPath, ARRAY_SIZE(DriverPath));
+	else if (gBS->OpenProtocol(TargetHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Volume,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_TEST_PROTOCOL) != EFI_SUCCESS)
+		return;
+	PrepareBootOptions(BootDeviceHandle, (Candidate != NO_DRIVER_CANDIDATE) ? DriverPath : NULL,
+		TargetHandle, LoaderPath, FileSystem[FsType].Name);
+}
+
+/*
+ * Open the target volume through its file system driver, correct the case
+ * of LoaderPath and load the bootloader it points to.
+ */
+STATIC EFI_STATUS LoadBootloader(CONST EFI_HANDLE TargetHandle, CONST UINTN FsType,
+	CHAR16* LoaderPath, CONST INTN SecureBootStatus, EFI_HANDLE* ImageHandle)
+{
+	EFI_STATUS Status;
+	EFI_DEVICE_PATH *DevicePath;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	EFI_FILE_SYSTEM_VOLUME_LABEL* VolumeInfo;
+	EFI_FILE_HANDLE Root;
+	UINTN Try, Size;
+#if !defined(NO_ARCH_DIAGNOSTIC)
+	CHAR16 LoaderPath2[64];
+	UINTN Index;
+#endif
+
+	PrintInfo(L"Opening target %s partition:", FileSystem[FsType].Name);
+	// Open the the volume, with retry, as we may need to wait before poking
+	// at the FS content, in case the system is slow to start our service...
+	for (Try = 0; ; Try++) {
+		Status = gBS->OpenProtocol(TargetHandle, &gEfiSimpleFileSystemProtocolGuid,
+			(VOID**)&Volume, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL);
+		if (!EFI_ERROR(Status))
+			break;
+		PrintErrorStatus(L"  Could not open partition");
+		if (Try >= NUM_RETRIES)
+			return Status;
+		PrintWarning(L"  Waiting %d seconds before retrying...", DELAY);
+		gBS->Stall(DELAY * 1000000);
+	}
+
+	// Open the root directory
+	Root = NULL;
+	Status = Volume->OpenVolume(Volume, &Root);
+	if ((EFI_ERROR(Status)) || (Root == NULL)) {
+		PrintErrorStatus(L"  Could not open Root directory");
+		return Status;
+	}
+
+	// Get the volume label while we're at it
 	Size = FILE_INFO_SIZE;
-	VolumeInfo = (EFI_FILE_SYSTEM_VOLUME_LABEL*)AllocateZeroPool(Size);
+	VolumeInfo = (EFI_FILE_SYSTEM_VOLUME_LABEL*)ArenaAllocateZero(Size);
 	if (VolumeInfo != NULL) {
 		Status = Root->GetInfo(Root, &gEfiFileSystemVolumeLabelInfoIdGuid, &Size, VolumeInfo);
 		// Some UEFI firmwares return EFI_BUFFER_TOO_SMALL, even with
@@ -486,12 +994,13 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE BaseImageHandle, EFI_SYSTEM_TABLE *SystemT
 			PrintInfo(L"  Volume label is '%s'", VolumeInfo->VolumeLabel);
 		else
 			PrintWarning(L"  Could not read volume label: [%d] %r\n", (Status & 0x7FFFFFFF), Status);
-		FreePool(VolumeInfo);
+		ArenaFree(VolumeInfo);
 	}
 
 	PrintInfo(L"This system uses %s UEFI => searching for %s UEFI bootloader", Arch[ArchIndex].CpuType, Arch[ArchIndex].EfiSuffix);
 	// This next call corrects the casing to the required one
 	Status = SetPathCase(Root, LoaderPath);
+#if !defined(NO_ARCH_DIAGNOSTIC)
 	if (Status == EFI_NOT_FOUND) {
 		// Some people mix their source images (e.g. downloaded Windows ARM64 when they
 		// really needed x64), so try to provide a more helpful error message then.
@@ -503,50 +1012,599 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE BaseImageHandle, EFI_SYSTEM_TABLE *SystemT
 				PrintWarning(L"Found incompatible %s UEFI bootloader instead", Arch[Index].EfiSuffix);
 				PrintError(L"You are trying to boot %s image on %s UEFI platform!", Arch[Index].Description, Arch[ArchIndex].Description);
 				PrintError(L"Please download %s compatible image and recreate the media", Arch[ArchIndex].Description);
-				goto out;
+				return Status;
 			}
 		}
 	}
+#endif
 	if (EFI_ERROR(Status)) {
 		PrintErrorStatus(L"  Could not locate '%s'", &LoaderPath[1]);
-		goto out;
+		return Status;
 	}
 
 	// At this stage, our DevicePath is the partition we are after
 	PrintInfo(L"Launching '%s'...", &LoaderPath[1]);
 
 	// Now attempt to chain load boot###.efi on the target partition
-	DevicePath = FileDevicePath(Handles[Index], LoaderPath);
+	DevicePath = FileDevicePath(TargetHandle, LoaderPath);
 	if (DevicePath == NULL) {
 		Status = EFI_DEVICE_ERROR;
 		PrintErrorStatus(L"  Could not create path");
-		goto out;
+		return Status;
 	}
-	Status = gBS->LoadImage(FALSE, MainImageHandle, DevicePath, NULL, 0, &ImageHandle);
+	Status = gBS->LoadImage(FALSE, MainImageHandle, DevicePath, NULL, 0, ImageHandle);
 	SafeFree(DevicePath);
 	if (EFI_ERROR(Status)) {
 		if ((Status == EFI_ACCESS_DENIED) && (SecureBootStatus >= 1))
 			Status = EFI_SECURITY_VIOLATION;
 		PrintErrorStatus(L"  Load failure");
+	}
+
+	return Status;
+}
+
+#if !defined(NO_DISK_IMAGE)
+/*
+ * Check for the boot sector of a FAT12, FAT16 or FAT32 file system. We don't
+ * have probes for FAT, as it would otherwise be taken for the target when it
+ * sits next to our boot partition, so this is only used for disk images.
+ */
+STATIC BOOLEAN IsFatBootSector(CONST UINT8* Buffer, CONST UINTN Size)
+{
+	if ((Size < 512) || (Buffer[0x1FE] != 0x55) || (Buffer[0x1FF] != 0xAA))
+		return FALSE;
+	return (CompareMem(&Buffer[0x36], "FAT1", 4) == 0) || (CompareMem(&Buffer[0x52], "FAT32   ", 8) == 0);
+}
+
+/*
+ * Mount the disk image at ImagePath, from the host partition we found, and
+ * look for a partition we can chain load from inside it, which may be a FAT
+ * partition serviced by the firmware, such as the ESP. On success, the
+ * target handle, file system type and first block are replaced with the
+ * ones from this partition.
+ */
+STATIC EFI_STATUS OpenDiskImage(CHAR16* ImagePath, CONST EFI_HANDLE BootDeviceHandle,
+	CONST INTN SecureBootStatus, EFI_HANDLE* TargetHandle, UINTN* FsType, CHAR8** FirstBlock)
+{
+	EFI_STATUS Status;
+	EFI_HANDLE DiskHandle = NULL, *Handles = NULL;
+	EFI_DEVICE_PATH *DiskPath, *ParentDevicePath;
+	EFI_BLOCK_IO_PROTOCOL* BlockIo;
+	CHAR8* Buffer = NULL;
+	UINTN Index, HandleCount = 0, Candidate, ImageFsType = FS_UNKNOWN;
+	BOOLEAN Child;
+
+	// Our exFAT reader can map the image to the partition, so that we don't
+	// need a driver. Otherwise, the image is read through the host's driver.
+	if ((*FsType != FS_EXFAT) ||
+		(MountDiskImage(*TargetHandle, *FirstBlock, ImagePath, &DiskHandle) != EFI_SUCCESS)) {
+		Status = StartDriverService(*TargetHandle, *FsType, BootDeviceHandle, SecureBootStatus,
+			ImagePath, &Candidate);
+		if (EFI_ERROR(Status))
+			return Status;
+		Status = MountDiskImage(*TargetHandle, NULL, ImagePath, &DiskHandle);
+		if (EFI_ERROR(Status))
+			return Status;
+	}
+
+	PrintInfo(L"Searching for target partition in disk image:");
+	DiskPath = DevicePathFromHandle(DiskHandle);
+	Status = gBS->LocateHandleBuffer(ByProtocol, &gEfiDiskIoProtocolGuid, NULL, &HandleCount, &Handles);
+	if (EFI_ERROR(Status)) {
+		PrintErrorStatus(L"  Failed to list disks");
+		return Status;
+	}
+	for (Index = 0; Index < HandleCount; Index++) {
+		ParentDevicePath = GetParentDevice(DevicePathFromHandle(Handles[Index]));
+		Child = (ParentDevicePath != NULL) && (CompareDevicePaths(DiskPath, ParentDevicePath) == 0);
+		SafeArenaFree(ParentDevicePath);
+		if (!Child)
+			continue;
+		Status = gBS->OpenProtocol(Handles[Index], &gEfiBlockIoProtocolGuid,
+			(VOID**)&BlockIo, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+		if (EFI_ERROR(Status))
+			continue;
+		Buffer = (CHAR8*)ArenaAllocate(BlockIo->Media->BlockSize);
+		if (Buffer == NULL)
+			continue;
+		ImageFsType = ProbeFileSystem(BlockIo, Buffer);
+		// Most images also have an ESP, that the firmware services natively
+		if ((ImageFsType == FS_UNKNOWN) && IsFatBootSector((UINT8*)Buffer, BlockIo->Media->BlockSize) &&
+			(gBS->OpenProtocol(Handles[Index], &gEfiSimpleFileSystemProtocolGuid, NULL,
+			MainImageHandle, NULL, EFI_OPEN_PROTOCOL_TEST_PROTOCOL) == EFI_SUCCESS))
+			ImageFsType = FS_FAT;
+		if (ImageFsType != FS_UNKNOWN)
+			break;
+		SafeArenaFree(Buffer);
+	}
+	if (Index >= HandleCount) {
+		Status = EFI_NOT_FOUND;
+		PrintErrorStatus(L"  Could not locate target partition");
 		goto out;
 	}
 
-	// Look for a "bootmgr.dll" string in the loaded image to identify a Windows bootloader.
-	BootMgrName[0] = BootMgrNameFirstLetter;
-	Status = gBS->OpenProtocol(ImageHandle, &gEfiLoadedImageProtocolGuid,
+	PrintInfo(L"Found %s target partition in disk image", FileSystem[ImageFsType].Name);
+	*TargetHandle = Handles[Index];
+	*FsType = ImageFsType;
+	SafeArenaFree(*FirstBlock);
+	*FirstBlock = Buffer;
+
+out:
+	SafeFree(Handles);
+	return Status;
+}
+#endif
+
+#else /* UEFI_NTFS_DRIVER */
+/*
+ * When built as a driver, we stay resident and connect our file system
+ * drivers to NTFS or exFAT partitions as soon as they appear, so that the
+ * firmware boot manager can see these volumes, including hot-plugged ones.
+ */
+STATIC EFI_HANDLE FileSystemDriver[ARRAY_SIZE(FileSystem)] = { 0 };
+STATIC VOID* DiskIoRegistration = NULL;
+
+/*
+ * Probe a DiskIo handle and, if it's a partition with one of the file
+ * systems we have a driver for, connect that driver to it.
+ */
+STATIC VOID AttachFileSystemDriver(CONST EFI_HANDLE Handle)
+{
+	EFI_STATUS Status;
+	EFI_BLOCK_IO_PROTOCOL *BlockIo;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	UINTN FsType;
+
+	Status = gBS->OpenProtocol(Handle, &gEfiBlockIoProtocolGuid, (VOID**)&BlockIo,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (EFI_ERROR(Status) || (BlockIo->Media == NULL) ||
+		(!BlockIo->Media->LogicalPartition) || (!BlockIo->Media->MediaPresent))
+		return;
+
+	// Leave partitions that are already serviced alone
+	if (gBS->OpenProtocol(Handle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Volume,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_TEST_PROTOCOL) == EFI_SUCCESS)
+		return;
+
+	FsType = ProbeFileSystem(BlockIo, NULL);
+	if ((FsType == FS_UNKNOWN) || (FileSystemDriver[FsType] == NULL))
+		return;
+
+	ConnectFileSystemDriver(Handle, FileSystemDriver[FsType]);
+}
+
+/*
+ * Protocol notification callback, for new DiskIo instances.
+ */
+STATIC VOID EFIAPI OnDiskIoInstalled(EFI_EVENT Event, VOID* Context)
+{
+	EFI_HANDLE Handle;
+	UINTN Size;
+
+	// Each call returns the next handle DiskIo was installed on since the last one
+	while (TRUE) {
+		Size = sizeof(Handle);
+		if (gBS->LocateHandle(ByRegisterNotify, NULL, DiskIoRegistration, &Size, &Handle) != EFI_SUCCESS)
+			break;
+		AttachFileSystemDriver(Handle);
+	}
+}
+
+/*
+ * Driver entry-point
+ */
+STATIC EFI_STATUS DriverMain(VOID)
+{
+	EFI_STATUS Status;
+	EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	EFI_FILE_HANDLE Root = NULL, File;
+	EFI_EVENT Event;
+	EFI_HANDLE* Handles = NULL;
+	CHAR16 DriverPath[64];
+	INTN SecureBootStatus = GetSecureBootStatus();
+	UINTN Index, HandleCount = 0, Loaded = 0;
+
+	Status = gBS->OpenProtocol(MainImageHandle, &gEfiLoadedImageProtocolGuid,
 		(VOID**)&LoadedImage, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
 	if (EFI_ERROR(Status)) {
-		PrintWarning(L"  Unable to inspect loaded executable");
-	} else for (Index = 0x40; Index < LoadedImage->ImageSize - sizeof(BootMgrName); Index++) {
-		if (CompareMem((CHAR8*)((UINTN)LoadedImage->ImageBase + Index),
-			BootMgrName, sizeof(BootMgrName)) == 0) {
-			WindowsBootMgr = TRUE;
-			PrintInfo(L"Starting Microsoft Windows bootmgr...");
+		PrintErrorStatus(L"Unable to access boot image interface");
+		return Status;
+	}
+
+	// Images can't be started from a notification callback, so load all the
+	// file system drivers we have upfront. Media usually only carry some of
+	// these, so the ones that aren't there are skipped without an error.
+	if ((gBS->OpenProtocol(LoadedImage->DeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Volume,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL) != EFI_SUCCESS) ||
+		(Volume->OpenVolume(Volume, &Root) != EFI_SUCCESS))
+		Root = NULL;
+	for (Index = 0; Index < ARRAY_SIZE(FileSystem); Index++) {
+		if (FileSystem[Index].DriverName == NULL)
+			continue;
+		if (Root != NULL) {
+			GetFileSystemDriverPath(Index, 0, DriverPath, ARRAY_SIZE(DriverPath));
+			if (Root->Open(Root, &File, DriverPath, EFI_FILE_MODE_READ, 0) != EFI_SUCCESS)
+				continue;
+			File->Close(File);
+		}
+		if (LoadFileSystemDriver(Index, 0, LoadedImage->DeviceHandle, SecureBootStatus,
+			&FileSystemDriver[Index]) == EFI_SUCCESS)
+			Loaded++;
+		else
+			FileSystemDriver[Index] = NULL;
+	}
+	if (Root != NULL)
+		Root->Close(Root);
+	if (Loaded == 0)
+		return EFI_NOT_FOUND;
+
+	Status = gBS->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, OnDiskIoInstalled, NULL, &Event);
+	if (EFI_ERROR(Status)) {
+		PrintErrorStatus(L"Could not create notification event");
+		return Status;
+	}
+	Status = gBS->RegisterProtocolNotify(&gEfiDiskIoProtocolGuid, Event, &DiskIoRegistration);
+	if (EFI_ERROR(Status)) {
+		PrintErrorStatus(L"Could not register for DiskIo notifications");
+		gBS->CloseEvent(Event);
+		return Status;
+	}
+
+	// We only get notified for new instances, so process the existing ones ourselves
+	Status = gBS->LocateHandleBuffer(ByProtocol, &gEfiDiskIoProtocolGuid, NULL, &HandleCount, &Handles);
+	if (!EFI_ERROR(Status)) {
+		for (Index = 0; Index < HandleCount; Index++)
+			AttachFileSystemDriver(Handles[Index]);
+		FreePool(Handles);
+	}
+
+	return EFI_SUCCESS;
+}
+#endif /* UEFI_NTFS_DRIVER */
+
+#if !defined(UEFI_NTFS_DRIVER)
+/*
+ * Persist a record of the failure, so that it can be retrieved once the
+ * machine has moved on, from the OS or the UEFI Shell.
+ */
+STATIC VOID RecordFailure(CONST EFI_STATUS ErrorStatus)
+{
+	EFI_STATUS Status;
+	EFI_TIME Time = { 0 };
+	CHAR16 Record[128];
+	UINTN Length;
+
+	gRT->GetTime(&Time, NULL);
+	Length = UnicodeSPrint(Record, sizeof(Record), L"status=0x%lx (%r) time=%04d-%02d-%02d %02d:%02d:%02d",
+		(UINT64)ErrorStatus, ErrorStatus, Time.Year, Time.Month, Time.Day, Time.Hour, Time.Minute, Time.Second);
+	Status = gRT->SetVariable(L"LastFailure", &gUefiNtfsVariableGuid, EFI_VARIABLE_NON_VOLATILE |
+		EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS, (Length + 1) * sizeof(CHAR16), Record);
+	if (EFI_ERROR(Status))
+		PrintWarning(L"Could not record failure: %r", Status);
+}
+
+/*
+ * Wait for a keystroke on error, so that the user can see what happened.
+ * Unattended machines can set an ErrorTimeout variable (UINT32, in seconds)
+ * under our vendor GUID, after which we either set BootNext to the option
+ * from an ErrorBootNext variable (UINT16) and reset, reset if there exists
+ * an ErrorReset variable, or return to the firmware.
+ */
+STATIC VOID WaitOnError(CONST EFI_STATUS ErrorStatus)
+{
+	EFI_STATUS Status;
+	EFI_EVENT Events[2];
+	UINT32 Timeout = 0;
+	UINT16 BootNext;
+	UINT8 Reset;
+	UINTN Index, EventCount = 1, Size = sizeof(Timeout);
+
+	if ((gRT->GetVariable(L"ErrorTimeout", &gUefiNtfsVariableGuid, NULL, &Size, &Timeout) != EFI_SUCCESS) ||
+		(Size != sizeof(Timeout)))
+		Timeout = 0;
+	// Only unattended setups need the failure in NVRAM, and writing it on every
+	// failed boot would wear the flash for no reason
+	if (Timeout != 0)
+		RecordFailure(ErrorStatus);
+	Events[0] = gST->ConIn->WaitForKey;
+	if ((Timeout != 0) && (gBS->CreateEvent(EVT_TIMER, 0, NULL, NULL, &Events[1]) == EFI_SUCCESS)) {
+		// The timer period is expressed in units of 100 ns
+		if (gBS->SetTimer(Events[1], TimerRelative, MultU64x32(Timeout, 10000000)) == EFI_SUCCESS)
+			EventCount = 2;
+		else
+			gBS->CloseEvent(Events[1]);
+	}
+
+	SetText(TEXT_YELLOW);
+	if (EventCount == 2)
+		Print(L"\nPress any key to exit (continuing automatically in %d seconds).\n", Timeout);
+	else
+		Print(L"\nPress any key to exit.\n");
+	DefText();
+	gST->ConIn->Reset(gST->ConIn, FALSE);
+	Status = gBS->WaitForEvent(EventCount, Events, &Index);
+	if (EventCount == 2)
+		gBS->CloseEvent(Events[1]);
+	// If someone is there to press a key, let them decide what to do next
+	if (EFI_ERROR(Status) || (Index == 0))
+		return;
+
+	Size = sizeof(BootNext);
+	if ((gRT->GetVariable(L"ErrorBootNext", &gUefiNtfsVariableGuid, NULL, &Size, &BootNext) == EFI_SUCCESS) &&
+		(Size == sizeof(BootNext))) {
+		Status = gRT->SetVariable(L"BootNext", &gEfiGlobalVariableGuid, EFI_VARIABLE_NON_VOLATILE |
+			EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS, sizeof(BootNext), &BootNext);
+		if (EFI_ERROR(Status)) {
+			PrintWarning(L"Could not set BootNext: %r", Status);
+			return;
+		}
+		PrintWarning(L"Rebooting to Boot%04X", BootNext);
+		gRT->ResetSystem(EfiResetCold, ErrorStatus, 0, NULL);
+	}
+	Size = sizeof(Reset);
+	Status = gRT->GetVariable(L"ErrorReset", &gUefiNtfsVariableGuid, NULL, &Size, &Reset);
+	if ((Status == EFI_SUCCESS) || (Status == EFI_BUFFER_TOO_SMALL)) {
+		PrintWarning(L"Rebooting");
+		gRT->ResetSystem(EfiResetCold, ErrorStatus, 0, NULL);
+	}
+}
+
+/*
+ * Application entry-point, where EntryTicks is the time we were started at
+ */
+STATIC EFI_STATUS ApplicationMain(CONST UINT64 EntryTicks)
+{
+	CHAR16 LoaderPath[64];
+#if !defined(NO_DISK_IMAGE)
+	CHAR16 ImagePath[PATH_MAX];
+#endif
+	CHAR16* DevicePathString;
+	EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+	EFI_STATUS Status;
+	EFI_DEVICE_PATH *DevicePath = NULL, *ParentDevicePath = NULL, *BootDiskPath = NULL;
+	EFI_DEVICE_PATH *BootPartitionPath = NULL;
+	EFI_HANDLE* Handles = NULL, ImageHandle = NULL, TargetHandle;
+	EFI_BLOCK_IO_PROTOCOL *BlockIo;
+	CHAR8* Buffer = NULL;
+	VOID* LoaderBuffer;
+	INTN SecureBootStatus;
+	UINT64 Start;
+	UINTN Index, FsType = 0, HandleCount = 0, LoaderSize, DriverCandidate = NO_DRIVER_CANDIDATE;
+	BOOLEAN SameDevice, DryRun, WindowsBootMgr = FALSE, FromDiskImage = FALSE, SkippedDriver = FALSE;
+
+	ArenaInit();
+
+#if !defined(NO_BANNER)
+	DisplayBanner();
+#endif
+#if !defined(NO_SYSTEM_INFO)
+	PrintSystemInfo();
+#endif
+	SecureBootStatus = GetSecureBootStatus();
+#if !defined(NO_INFO_STRINGS)
+	SetText(TEXT_WHITE);
+	Print(L"[INFO]");
+	DefText();
+	Print(L" Secure Boot status: ");
+	if (SecureBootStatus == 0) {
+		Print(L"Disabled\n");
+	} else {
+		SetText((SecureBootStatus > 0) ? TEXT_WHITE : TEXT_YELLOW);
+		Print(L"%s\n", (SecureBootStatus > 0) ? L"Enabled" : L"Setup");
+		DefText();
+	}
+#endif
+
+	Status = gBS->OpenProtocol(MainImageHandle, &gEfiLoadedImageProtocolGuid,
+		(VOID**)&LoadedImage, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (EFI_ERROR(Status)) {
+		PrintErrorStatus(L"Unable to access boot image interface");
+		goto out;
+	}
+#if !defined(NO_LOADER_INTERFACE)
+	SetLoaderInterface(LoadedImage, EntryTicks);
+#endif
+
+	DryRun = IsDryRun(LoadedImage);
+	if (DryRun)
+		PrintWarning(L"Dry run: the bootloader will be loaded but not started");
+
+#if !defined(NO_PREFETCH)
+	PrefetchFileSystemDrivers(LoadedImage->DeviceHandle);
+#endif
+
+	CaptureTopology(LoadedImage->DeviceHandle);
+
+	Start = GetTimestamp();
+	if (GetFirmwareQuirks() & QUIRK_DISCONNECT_BLOCKING_DRIVERS) {
+		PrintInfo(L"Disconnecting potentially blocking drivers");
+		DisconnectBlockingDrivers();
+		ArenaCheckpoint(L"disconnect");
+	}
+	StepTicks[STEP_DISCONNECT] = GetTimestamp() - Start;
+
+	// Identify our boot partition and disk
+	Start = GetTimestamp();
+	BootPartitionPath = DevicePathFromHandle(LoadedImage->DeviceHandle);
+	BootDiskPath = GetParentDevice(BootPartitionPath);
+
+	PrintInfo(L"Searching for target partition on boot disk:");
+	DevicePathString = DevicePathToString(BootDiskPath);
+	PrintInfo(L"  %s", DevicePathString);
+	SafeArenaFree(DevicePathString);
+	// Enumerate all disk handles
+	Status = gBS->LocateHandleBuffer(ByProtocol, &gEfiDiskIoProtocolGuid,
+		NULL, &HandleCount, &Handles);
+	if (EFI_ERROR(Status)) {
+		PrintErrorStatus(L"  Failed to list disks");
+		goto out;
+	}
+
+	// Go through the partitions and find the one that has the USB Disk we booted from
+	// as parent and that isn't the FAT32 boot partition
+	for (Index = 0; Index < HandleCount; Index++) {
+		// Note: The Device Path obtained from DevicePathFromHandle() should NOT be freed!
+		DevicePath = DevicePathFromHandle(Handles[Index]);
+		// Eliminate the partition we booted from
+		if (CompareDevicePaths(DevicePath, BootPartitionPath) == 0)
+			continue;
+		// Ensure that we look for the NTFS/exFAT partition on the same device.
+		ParentDevicePath = GetParentDevice(DevicePath);
+		SameDevice = (CompareDevicePaths(BootDiskPath, ParentDevicePath) == 0);
+		SafeArenaFree(ParentDevicePath);
+		// The check breaks QEMU testing (since we can't easily emulate
+		// a multipart device on the fly) so only do it for release.
+#if !defined(_DEBUG)
+		if (!SameDevice)
+			continue;
+#else
+		(VOID)SameDevice;	// Silence a MinGW warning
+#endif
+		// Identify the file system of the partition
+		Status = gBS->OpenProtocol(Handles[Index], &gEfiBlockIoProtocolGuid,
+			(VOID**)&BlockIo, MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+		if (EFI_ERROR(Status))
+			continue;
+		Buffer = (CHAR8*)ArenaAllocate(BlockIo->Media->BlockSize);
+		if (Buffer == NULL)
+			continue;
+		FsType = ProbeFileSystem(BlockIo, Buffer);
+		// Keep the first block of the partition we select, as we may need to parse it
+		if (FsType != FS_UNKNOWN)
 			break;
+		SafeArenaFree(Buffer);
+	}
+
+	if (Index >= HandleCount) {
+		Status = EFI_NOT_FOUND;
+		PrintErrorStatus(L"  Could not locate target partition");
+		goto out;
+	}
+	PrintInfo(L"Found %s target partition:", FileSystem[FsType].Name);
+	DevicePathString = DevicePathToString(DevicePath);
+	PrintInfo(L"  %s", DevicePathString);
+	SafeArenaFree(DevicePathString);
+	SafeArenaFree(BootDiskPath);
+	ArenaCheckpoint(L"scan");
+	StepTicks[STEP_SCAN] = GetTimestamp() - Start;
+	TargetHandle = Handles[Index];
+#if !defined(NO_READ_STATS)
+	StartReadStats(TargetHandle);
+#endif
+
+#if !defined(NO_DISK_IMAGE)
+	if (GetDiskImagePath(LoadedImage, ImagePath, ARRAY_SIZE(ImagePath))) {
+		Status = OpenDiskImage(ImagePath, LoadedImage->DeviceHandle, SecureBootStatus,
+			&TargetHandle, &FsType, &Buffer);
+		if (EFI_ERROR(Status))
+			goto out;
+		FromDiskImage = TRUE;
+	}
+#endif
+
+	// Our target file system is case sensitive, so we need to figure out the
+	// case sensitive version of the following
+	UnicodeSPrint(LoaderPath, ARRAY_SIZE(LoaderPath), L"\\efi\\boot\\boot%s.efi", Arch[ArchIndex].EfiSuffix);
+
+	// exFAT is simple enough for us to read the bootloader ourselves, in which
+	// case we only need the exFAT driver if the bootloader can't do without it.
+	// Windows bootmgr reads BCD and boot.wim through the file systems of its own
+	// boot library rather than through UEFI, so we first try it without the
+	// driver, and start it again through the driver should it fail (see below).
+	if (FsType == FS_EXFAT) {
+		Start = GetTimestamp();
+		PrintInfo(L"This system uses %s UEFI => reading %s UEFI bootloader", Arch[ArchIndex].CpuType, Arch[ArchIndex].EfiSuffix);
+		Status = ExFatReadFile(TargetHandle, Buffer, LoaderPath, &LoaderBuffer, &LoaderSize);
+		if (Status == EFI_SUCCESS) {
+			DevicePath = FileDevicePath(TargetHandle, LoaderPath);
+			Status = (DevicePath == NULL) ? EFI_DEVICE_ERROR :
+				gBS->LoadImage(FALSE, MainImageHandle, DevicePath, LoaderBuffer, LoaderSize, &ImageHandle);
+			SafeFree(DevicePath);
+			SafeArenaFree(LoaderBuffer);
+		}
+		if (EFI_ERROR(Status)) {
+			PrintWarning(L"  Could not load '%s' directly: %r", &LoaderPath[1], Status);
+			ImageHandle = NULL;
+		} else {
+			PrintInfo(L"  Loaded '%s'", &LoaderPath[1]);
+			WindowsBootMgr = IsWindowsBootMgr(ImageHandle);
 		}
+		StepTicks[STEP_DIRECT_READ] = GetTimestamp() - Start;
+	}
+
+	// If the partition is not/no-longer serviced, start our file system driver.
+	// FAT, which we only get from disk images, is serviced by the firmware.
+	if (!WindowsBootMgr && (FsType != FS_FAT)) {
+		Start = GetTimestamp();
+		Status = StartDriverService(TargetHandle, FsType, LoadedImage->DeviceHandle, SecureBootStatus,
+			LoaderPath, &DriverCandidate);
+		if (EFI_ERROR(Status)) {
+			if (ImageHandle == NULL)
+				goto out;
+			// We already have the bootloader, which may not need the driver
+			PrintWarning(L"  Continuing without the %s driver", FileSystem[FsType].Name);
+			DriverCandidate = NO_DRIVER_CANDIDATE;
+			Status = EFI_SUCCESS;
+		}
+		ArenaCheckpoint(L"driver");
+		StepTicks[STEP_DRIVER] = GetTimestamp() - Start;
+	} else if (WindowsBootMgr) {
+		SkippedDriver = TRUE;
+	}
+
+	if (ImageHandle == NULL) {
+		Start = GetTimestamp();
+		Status = LoadBootloader(TargetHandle, FsType, LoaderPath, SecureBootStatus, &ImageHandle);
+		if (EFI_ERROR(Status))
+			goto out;
+		WindowsBootMgr = IsWindowsBootMgr(ImageHandle);
+		StepTicks[STEP_LOADER] = GetTimestamp() - Start;
 	}
 
+	// Let the firmware boot the target directly next time, once it has booted, unless
+	// it is in a disk image, which the firmware can't access on its own
+	if (!DryRun && !FromDiskImage)
+		PrepareDirectBoot(LoadedImage->DeviceHandle, TargetHandle, FsType, DriverCandidate, LoaderPath);
+
+	if (DryRun) {
+		PrintDryRunReport(TargetHandle, FsType, LoaderPath, WindowsBootMgr);
+		gBS->UnloadImage(ImageHandle);
+		goto out;
+	}
+
+	if (WindowsBootMgr)
+		PrintInfo(L"Starting Microsoft Windows bootmgr...");
+
+	// Release everything we allocated, so that the bootloader
+	// inherits the memory map as it was before we started.
+#if !defined(NO_PREFETCH)
+	StopPrefetch();
+#endif
+	SafeArenaFree(Buffer);
+	SafeFree(Handles);
+	ArenaCheckpoint(L"loader");
+	ArenaRelease();
+
+#if !defined(NO_LOADER_INTERFACE)
+	SetLoaderExecTime();
+#endif
 	Status = gBS->StartImage(ImageHandle, NULL, NULL);
+	// If Windows bootmgr could not do without our exFAT driver, start it through the driver
+	if (EFI_ERROR(Status) && SkippedDriver) {
+		PrintWarning(L"Windows bootmgr failed without the %s driver: %r", FileSystem[FsType].Name, Status);
+		SkippedDriver = FALSE;
+		Status = StartDriverService(TargetHandle, FsType, LoadedImage->DeviceHandle, SecureBootStatus,
+			LoaderPath, &DriverCandidate);
+		if (EFI_ERROR(Status))
+			goto out;
+		Status = LoadBootloader(TargetHandle, FsType, LoaderPath, SecureBootStatus, &ImageHandle);
+		if (EFI_ERROR(Status))
+			goto out;
+		if (!FromDiskImage)
+			PrepareDirectBoot(LoadedImage->DeviceHandle, TargetHandle, FsType, DriverCandidate, LoaderPath);
+		Status = gBS->StartImage(ImageHandle, NULL, NULL);
+	}
 	if (EFI_ERROR(Status)) {
 		// Windows bootmgr simply returns EFI_NO_MAPPING on any internal error or security
 		// violation, instead of halting and explicitly reporting the issue, leaving many
@@ -561,18 +1619,46 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE BaseImageHandle, EFI_SYSTEM_TABLE *SystemT
 	}
 
 out:
-	SafeFree(ParentDevicePath);
-	SafeFree(BootDiskPath);
+	CommitBootOptions(!EFI_ERROR(Status));
+#if !defined(NO_DISK_IMAGE)
+	UnmountDiskImage();
+#endif
+#if !defined(NO_PREFETCH)
+	StopPrefetch();
+#endif
+#if !defined(NO_READ_STATS)
+	StopReadStats();
+#endif
+	SafeArenaFree(Buffer);
+	SafeArenaFree(ParentDevicePath);
+	SafeArenaFree(BootDiskPath);
 	SafeFree(Handles);
+	ArenaRelease();
 
-	// Wait for a keystroke on error
-	if (EFI_ERROR(Status)) {
-		SetText(TEXT_YELLOW);
-		Print(L"\nPress any key to exit.\n");
-		DefText();
-		gST->ConIn->Reset(gST->ConIn, FALSE);
-		gST->BootServices->WaitForEvent(1, &gST->ConIn->WaitForKey, &Event);
-	}
+	if (EFI_ERROR(Status))
+		WaitOnError(Status);
 
 	return Status;
 }
+#endif
+
+/*
+ * Image entry-point
+ * NB: This must be set to 'efi_main' for gnu-efi crt0 compatibility
+ */
+EFI_STATUS EFIAPI efi_main(EFI_HANDLE BaseImageHandle, EFI_SYSTEM_TABLE *SystemTable)
+{
+#if !defined(UEFI_NTFS_DRIVER)
+	UINT64 EntryTicks = GetTimestamp();
+#endif
+
+#if defined(_GNU_EFI)
+	InitializeLib(BaseImageHandle, SystemTable);
+#endif
+	MainImageHandle = BaseImageHandle;
+#if defined(UEFI_NTFS_DRIVER)
+	return DriverMain();
+#else
+	return ApplicationMain(EntryTicks);
+#endif
+}
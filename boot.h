@@ -75,6 +75,11 @@
 /* Delay before retry, in seconds*/
 #define DELAY               3
 
+/* Macro used to compute the offset of a field in a structure */
+#ifndef OFFSET_OF
+#define OFFSET_OF(Type, Field)  ((UINTN)&(((Type*)0)->Field))
+#endif
+
 /* Macro used to compute the size of an array */
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(Array)   (sizeof(Array) / sizeof((Array)[0]))
@@ -83,6 +88,9 @@
 /* FreePool() replacement, that NULLs the freed pointer. */
 #define SafeFree(p)          do { FreePool(p); p = NULL;} while(0)
 
+/* ArenaFree() replacement, that NULLs the freed pointer. */
+#define SafeArenaFree(p)     do { ArenaFree(p); p = NULL;} while(0)
+
 /* Maximum line size for our banner */
 #define BANNER_LINE_SIZE     79
 
@@ -102,11 +110,42 @@
 #define SetText(attr)        gST->ConOut->SetAttribute(gST->ConOut, (attr))
 #define DefText()            gST->ConOut->SetAttribute(gST->ConOut, TEXT_DEFAULT)
 
+/*
+ * A lean build compiles out everything that isn't needed to chain load.
+ * Each of the NO_ switches below can also be defined on its own.
+ */
+#if defined(LEAN)
+#define NO_BANNER
+#define NO_SYSTEM_INFO
+#define NO_DRIVER_NAME
+#define NO_ARCH_DIAGNOSTIC
+#define NO_DEVICE_PATH_FALLBACK
+#define NO_INFO_STRINGS
+#define NO_LOADER_INTERFACE
+#define NO_DRIVER_SELECTION
+#define NO_READ_STATS
+#define NO_DISK_IMAGE
+#define NO_PREFETCH
+#endif
+
+/* The resident driver doesn't start bootloaders, so it has nothing to report */
+#if defined(UEFI_NTFS_DRIVER)
+#define NO_LOADER_INTERFACE
+#define NO_READ_STATS
+#define NO_DISK_IMAGE
+#define NO_PREFETCH
+#endif
+
 /*
  * Convenience macros to print informational, warning or error messages.
  */
+#if defined(NO_INFO_STRINGS)
+/* Keep the arguments referenced, so that values only used for reporting don't warn */
+#define PrintInfo(fmt, ...)         do { if (0) Print(L"" fmt, ##__VA_ARGS__); } while(0)
+#else
 #define PrintInfo(fmt, ...)         do { SetText(TEXT_WHITE); Print(L"[INFO]"); DefText(); \
                                          Print(L" " fmt L"\n", ##__VA_ARGS__); } while(0)
+#endif
 #define PrintWarning(fmt, ...)      do { SetText(TEXT_YELLOW); Print(L"[WARN]"); DefText(); \
                                          Print(L" " fmt L"\n", ##__VA_ARGS__); } while(0)
 #define PrintError(fmt, ...)        do { SetText(TEXT_RED); Print(L"[FAIL]"); DefText(); \
@@ -179,12 +218,90 @@ STATIC __inline VOID _SafeStrCpy(CHAR16* Destination, UINTN DestMax,
 
 #define SafeStrCpy(d, l, s) _SafeStrCpy(d, l, s, __FILE__, __LINE__)
 
+/* Vendor GUID for the UEFI:NTFS variables */
+#define UEFI_NTFS_VARIABLE_GUID \
+	{ 0xb39f9004, 0xcc5e, 0x4df7, { 0x95, 0xe3, 0x34, 0xd6, 0xce, 0xa7, 0xd4, 0xd0 } }
+
+/*
+ * Firmware workarounds that can be toggled per platform
+ */
+#define QUIRK_DISCONNECT_BLOCKING_DRIVERS   0x00000001
+#define QUIRK_UNLOAD_NATIVE_DRIVER          0x00000002
+#define QUIRK_RECURSIVE_CONNECT             0x00000004  /* Skip the non-recursive connect */
+#define QUIRK_NON_RECURSIVE_CONNECT         0x00000008  /* Never escalate to a recursive connect */
+#ifndef QUIRK_DEFAULT
+#define QUIRK_DEFAULT                       0           /* Platforms that don't need any workaround */
+#endif
+#define QUIRK_UNIDENTIFIED                  (QUIRK_DISCONNECT_BLOCKING_DRIVERS | QUIRK_UNLOAD_NATIVE_DRIVER)
+
+/*
+ * gnu-efi's memory primitives are byte loops, so we use the ones from mem.c.
+ * This is limited to GCC and Clang, as MSVC may turn the loops of mem.c back
+ * into memset()/memcpy() calls, which gnu-efi implements as byte loops too.
+ */
+#if defined(__MAKEWITH_GNUEFI) && defined(__GNUC__)
+#define CompareMem          FastCompareMem
+#define CopyMem             FastCopyMem
+#define ZeroMem             FastZeroMem
+#define ScanMem8            FastScanMem8
+INTN FastCompareMem(CONST VOID* Buffer1, CONST VOID* Buffer2, UINTN Length);
+VOID FastCopyMem(VOID* Destination, CONST VOID* Source, UINTN Length);
+VOID FastZeroMem(VOID* Buffer, UINTN Length);
+VOID* FastScanMem8(CONST VOID* Buffer, UINTN Length, CONST UINT8 Value);
+#endif
+
+/* A range of a file that is stored contiguously on its partition */
+typedef struct {
+	UINT64 FileOffset;
+	UINT64 DiskOffset;
+	UINT64 Length;
+} FILE_EXTENT;
+
+/* Global handle for the current executable */
+extern EFI_HANDLE MainImageHandle;
+extern EFI_GUID gUefiNtfsVariableGuid;
+
 /*
  * Function prototypes
  */
+EFI_STATUS ArenaInit(VOID);
+VOID* ArenaAllocate(CONST UINTN Size);
+VOID* ArenaAllocateZero(CONST UINTN Size);
+VOID ArenaFree(VOID* Ptr);
+VOID ArenaCheckpoint(CONST CHAR16* Phase);
+VOID ArenaRelease(VOID);
+UINTN GetDevicePathLength(CONST EFI_DEVICE_PATH* DevicePath);
 EFI_DEVICE_PATH* GetParentDevice(CONST EFI_DEVICE_PATH* DevicePath);
 INTN CompareDevicePaths(CONST EFI_DEVICE_PATH* dp1, CONST EFI_DEVICE_PATH* dp2);
 EFI_STATUS SetPathCase(CONST EFI_FILE_HANDLE Root, CHAR16* Path);
 CHAR16* DevicePathToString(CONST EFI_DEVICE_PATH* DevicePath);
+EFI_DEVICE_PATH_TO_TEXT_PROTOCOL* GetDevicePathToText(VOID);
+CHAR16* GetDriverName(CONST EFI_HANDLE DriverHandle);
+EFI_DRIVER_BINDING_PROTOCOL* GetDriverBinding(CONST EFI_HANDLE DriverHandle);
+EFI_STATUS UnloadDriverImage(CONST EFI_HANDLE ImageHandle);
+EFI_STATUS DisconnectDriver(CONST EFI_HANDLE ControllerHandle, CONST EFI_HANDLE DriverHandle);
 EFI_STATUS PrintSystemInfo(VOID);
+UINT32 GetFirmwareQuirks(VOID);
+CONST CHAR8* GetPlatformName(VOID);
 INTN GetSecureBootStatus(VOID);
+VOID* FindMem(CONST VOID* Buffer, CONST UINTN Length, CONST VOID* Pattern, CONST UINTN PatternLength);
+UINT64 GetTimestamp(VOID);
+UINT64 TicksToMicroseconds(CONST UINT64 Ticks);
+VOID CaptureTopology(CONST EFI_HANDLE DeviceHandle);
+VOID SetLoaderInterface(CONST EFI_LOADED_IMAGE_PROTOCOL* LoadedImage, CONST UINT64 StartTicks);
+VOID SetLoaderExecTime(VOID);
+VOID StartReadStats(CONST EFI_HANDLE TargetHandle);
+VOID StopReadStats(VOID);
+VOID PrepareBootOptions(CONST EFI_HANDLE BootDeviceHandle, CONST CHAR16* DriverPath,
+	CONST EFI_HANDLE TargetHandle, CONST CHAR16* LoaderPath, CONST CHAR16* FsName);
+VOID CommitBootOptions(CONST BOOLEAN Booted);
+EFI_STATUS ExFatReadFile(CONST EFI_HANDLE Handle, CONST VOID* BootSector,
+	CHAR16* Path, VOID** Data, UINTN* DataSize);
+EFI_STATUS ExFatGetFileExtents(CONST EFI_HANDLE Handle, CONST VOID* BootSector,
+	CHAR16* Path, FILE_EXTENT** Extents, UINTN* ExtentCount, UINT64* FileSize);
+EFI_STATUS MountDiskImage(CONST EFI_HANDLE HostHandle, CONST VOID* HostBootSector,
+	CHAR16* Path, EFI_HANDLE* DiskHandle);
+VOID UnmountDiskImage(VOID);
+VOID StartPrefetch(CONST EFI_HANDLE DeviceHandle, CONST CHAR16* Path);
+VOID* GetPrefetchedFile(CONST CHAR16* Path, UINTN* Size);
+VOID StopPrefetch(VOID);
@@ -0,0 +1,393 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Boot option registration
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+#ifndef LOAD_OPTION_ACTIVE
+#define LOAD_OPTION_ACTIVE          0x00000001
+#endif
+#ifndef LOAD_OPTION_FORCE_RECONNECT
+#define LOAD_OPTION_FORCE_RECONNECT 0x00000002
+#endif
+
+#define LOAD_OPTION_VARIABLE_ATTRIBUTES \
+	(EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+
+/*
+ * When enabled, through the "EnableBootOptions" variable, we register a
+ * Driver#### option for the file system driver we started and a Boot####
+ * option for the target bootloader, so that the firmware can boot the media
+ * directly next time around. The options we create are identified by our
+ * vendor GUID, which we use as their optional data, and are updated in place
+ * when the target changes, so that any position the user gave them in the
+ * boot order is preserved. New options go to the top of the order.
+ *
+ * As we don't want to leave options that point to something that can't boot,
+ * the variable writes are only queued until the bootloader calls
+ * ExitBootServices() or returns successfully. SetVariable() may not be called
+ * above TPL_CALLBACK, so our ExitBootServices() notification runs at that TPL.
+ * It then runs after the TPL_NOTIFY ones, such as the one in which variable
+ * drivers switch to runtime mode, which some firmwares don't expect, and on
+ * these the options are simply not written. If the firmware tried our
+ * Boot#### option before it ran us, that option didn't work, so rather than
+ * putting it back on top, we move it to the end of the boot order.
+ */
+
+typedef struct _PENDING_WRITE {
+	struct _PENDING_WRITE* Next;
+	CHAR16 Name[16];
+	UINTN Size;
+	UINT8 Data[1];
+} PENDING_WRITE;
+
+STATIC struct {
+	PENDING_WRITE* Head;
+	PENDING_WRITE** Tail;
+	EFI_EVENT ExitBootServicesEvent;
+	BOOLEAN Written;
+} BootOptions = { NULL, &BootOptions.Head, NULL, FALSE };
+
+/*
+ * Read a global variable into a newly allocated buffer.
+ */
+STATIC VOID* GetGlobalVariable(CONST CHAR16* Name, UINTN* Size)
+{
+	VOID* Data;
+
+	*Size = 0;
+	if (gRT->GetVariable((CHAR16*)Name, &gEfiGlobalVariableGuid, NULL, Size, NULL) != EFI_BUFFER_TOO_SMALL)
+		return NULL;
+	Data = AllocatePool(*Size);
+	if (Data == NULL)
+		return NULL;
+	if (gRT->GetVariable((CHAR16*)Name, &gEfiGlobalVariableGuid, NULL, Size, Data) != EFI_SUCCESS)
+		SafeFree(Data);
+	return Data;
+}
+
+/*
+ * Create an EFI_LOAD_OPTION, tagged with our vendor GUID.
+ */
+STATIC UINT8* CreateLoadOption(CONST UINT32 Attributes, CONST CHAR16* Description,
+	CONST EFI_DEVICE_PATH* DevicePath, UINTN* Size)
+{
+	UINT8* Option;
+	UINT16 DevicePathSize = (UINT16)GetDevicePathLength(DevicePath);
+	UINTN DescriptionSize = StrSize(Description);
+
+	*Size = sizeof(UINT32) + sizeof(UINT16) + DescriptionSize + DevicePathSize + sizeof(EFI_GUID);
+	Option = AllocatePool(*Size);
+	if (Option == NULL)
+		return NULL;
+	CopyMem(Option, &Attributes, sizeof(UINT32));
+	CopyMem(&Option[sizeof(UINT32)], &DevicePathSize, sizeof(UINT16));
+	CopyMem(&Option[sizeof(UINT32) + sizeof(UINT16)], Description, DescriptionSize);
+	CopyMem(&Option[sizeof(UINT32) + sizeof(UINT16) + DescriptionSize], DevicePath, DevicePathSize);
+	CopyMem(&Option[*Size - sizeof(EFI_GUID)], &gUefiNtfsVariableGuid, sizeof(EFI_GUID));
+	return Option;
+}
+
+/*
+ * Check if Type#### option Number is one that we created.
+ */
+STATIC BOOLEAN IsOurLoadOption(CONST CHAR16* Type, CONST UINT16 Number, UINT8** Variable, UINTN* VariableSize)
+{
+	CHAR16 VariableName[16];
+	UINT8* Data;
+	UINTN Size;
+
+	UnicodeSPrint(VariableName, sizeof(VariableName), L"%s%04X", Type, Number);
+	Data = GetGlobalVariable(VariableName, &Size);
+	if (Data == NULL)
+		return FALSE;
+	if ((Size < sizeof(EFI_GUID)) ||
+		(CompareMem(&Data[Size - sizeof(EFI_GUID)], &gUefiNtfsVariableGuid, sizeof(EFI_GUID)) != 0)) {
+		SafeFree(Data);
+		return FALSE;
+	}
+	if (Variable != NULL) {
+		*Variable = Data;
+		*VariableSize = Size;
+	} else {
+		SafeFree(Data);
+	}
+	return TRUE;
+}
+
+/*
+ * Queue the write of a global variable, or its deletion if Size is 0.
+ */
+STATIC EFI_STATUS QueueWrite(CONST CHAR16* Name, CONST VOID* Data, CONST UINTN Size)
+{
+	PENDING_WRITE* Write = AllocatePool(sizeof(PENDING_WRITE) + Size);
+
+	if (Write == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	Write->Next = NULL;
+	SafeStrCpy(Write->Name, ARRAY_SIZE(Write->Name), Name);
+	Write->Size = Size;
+	if (Size != 0)
+		CopyMem(Write->Data, Data, Size);
+	*BootOptions.Tail = Write;
+	BootOptions.Tail = &Write->Next;
+	return EFI_SUCCESS;
+}
+
+/*
+ * Perform the queued writes. This may be called from our ExitBootServices()
+ * notification, so this must not allocate or free memory.
+ */
+STATIC VOID WritePendingWrites(VOID)
+{
+	PENDING_WRITE* Write;
+
+	if (BootOptions.Written)
+		return;
+	BootOptions.Written = TRUE;
+	for (Write = BootOptions.Head; Write != NULL; Write = Write->Next)
+		gRT->SetVariable(Write->Name, &gEfiGlobalVariableGuid,
+			(Write->Size == 0) ? 0 : LOAD_OPTION_VARIABLE_ATTRIBUTES, Write->Size,
+			(Write->Size == 0) ? NULL : Write->Data);
+}
+
+STATIC VOID EFIAPI OnExitBootServices(EFI_EVENT Event, VOID* Context)
+{
+	WritePendingWrites();
+}
+
+STATIC VOID DiscardPendingWrites(VOID)
+{
+	PENDING_WRITE* Write;
+
+	while (BootOptions.Head != NULL) {
+		Write = BootOptions.Head;
+		BootOptions.Head = Write->Next;
+		FreePool(Write);
+	}
+	BootOptions.Tail = &BootOptions.Head;
+	BootOptions.Written = FALSE;
+}
+
+/*
+ * Queue the writes that make Option the only Type#### option we own, or that
+ * remove the options we own if Option is NULL. An option we already own keeps
+ * its number and its position in the order, unless Demote is set, in which
+ * case it is moved to the end.
+ */
+STATIC EFI_STATUS QueueLoadOption(CONST CHAR16* Type, CONST UINT8* Option, CONST UINTN OptionSize,
+	CONST BOOLEAN Demote)
+{
+	EFI_STATUS Status = EFI_SUCCESS;
+	CHAR16 OrderName[16], VariableName[16];
+	UINT8* Variable;
+	UINT16 *Order, *NewOrder = NULL, *Stale = NULL, Number = 0;
+	UINTN i, Count, NewCount = 0, StaleCount = 0, VariableSize;
+	BOOLEAN Found = FALSE;
+
+	UnicodeSPrint(OrderName, sizeof(OrderName), L"%sOrder", Type);
+	Order = GetGlobalVariable(OrderName, &Count);
+	Count = (Order == NULL) ? 0 : Count / sizeof(UINT16);
+	NewOrder = AllocatePool((Count + 1) * sizeof(UINT16));
+	Stale = AllocatePool((Count + 1) * sizeof(UINT16));
+	if ((NewOrder == NULL) || (Stale == NULL)) {
+		Status = EFI_OUT_OF_RESOURCES;
+		goto out;
+	}
+
+	// Keep the first option we own, in place, and remove the others
+	for (i = 0; i < Count; i++) {
+		if (!IsOurLoadOption(Type, Order[i], &Variable, &VariableSize)) {
+			NewOrder[NewCount++] = Order[i];
+			continue;
+		}
+		if ((!Found) && (Option != NULL)) {
+			Found = TRUE;
+			Number = Order[i];
+			if ((VariableSize != OptionSize) || (CompareMem(Variable, Option, OptionSize) != 0)) {
+				UnicodeSPrint(VariableName, sizeof(VariableName), L"%s%04X", Type, Number);
+				Status = QueueWrite(VariableName, Option, OptionSize);
+			}
+			if (!Demote)
+				NewOrder[NewCount++] = Number;
+		} else {
+			Stale[StaleCount++] = Order[i];
+		}
+		SafeFree(Variable);
+		if (EFI_ERROR(Status))
+			goto out;
+	}
+
+	if ((Option != NULL) && (!Found)) {
+		// Find an unused option number
+		for (Number = 0; Number < 0xFFFF; Number++) {
+			UnicodeSPrint(VariableName, sizeof(VariableName), L"%s%04X", Type, Number);
+			VariableSize = 0;
+			if (gRT->GetVariable(VariableName, &gEfiGlobalVariableGuid, NULL, &VariableSize, NULL) == EFI_NOT_FOUND)
+				break;
+		}
+		if (Number == 0xFFFF) {
+			Status = EFI_OUT_OF_RESOURCES;
+			goto out;
+		}
+		Status = QueueWrite(VariableName, Option, OptionSize);
+		if (EFI_ERROR(Status))
+			goto out;
+		if (!Demote) {
+			CopyMem(&NewOrder[1], NewOrder, NewCount * sizeof(UINT16));
+			NewOrder[0] = Number;
+			NewCount++;
+		}
+	}
+	if ((Option != NULL) && Demote)
+		NewOrder[NewCount++] = Number;
+
+	if ((NewCount != Count) || (CompareMem(NewOrder, Order, Count * sizeof(UINT16)) != 0))
+		Status = QueueWrite(OrderName, NewOrder, NewCount * sizeof(UINT16));
+	// Only delete stale options once they are no longer referenced
+	for (i = 0; (!EFI_ERROR(Status)) && (i < StaleCount); i++) {
+		UnicodeSPrint(VariableName, sizeof(VariableName), L"%s%04X", Type, Stale[i]);
+		Status = QueueWrite(VariableName, NULL, 0);
+	}
+
+out:
+	SafeFree(Order);
+	SafeFree(NewOrder);
+	SafeFree(Stale);
+	return Status;
+}
+
+/*
+ * Check whether the firmware tried the Boot#### option we own, and fell back
+ * to the one that ran us. This is the case if our option comes before the
+ * current one in the boot order, or if the current option isn't part of the
+ * boot order. Booting our media from a boot menu looks the same, which is
+ * harmless, as all it does is move our option to the end of the boot order.
+ */
+STATIC BOOLEAN IsFallbackBoot(VOID)
+{
+	UINT16 *Order, *Current;
+	UINTN i, Count, CurrentIndex, Size;
+	BOOLEAN Fallback = FALSE;
+
+	Current = GetGlobalVariable(L"BootCurrent", &Size);
+	if ((Current == NULL) || (Size != sizeof(UINT16))) {
+		SafeFree(Current);
+		return FALSE;
+	}
+	Order = GetGlobalVariable(L"BootOrder", &Size);
+	Count = (Order == NULL) ? 0 : Size / sizeof(UINT16);
+	for (CurrentIndex = 0; (CurrentIndex < Count) && (Order[CurrentIndex] != *Current); CurrentIndex++);
+	for (i = 0; (i < CurrentIndex) && (!Fallback); i++)
+		Fallback = IsOurLoadOption(L"Boot", Order[i], NULL, NULL);
+
+	SafeFree(Current);
+	SafeFree(Order);
+	return Fallback;
+}
+
+/*
+ * Queue the options that boot LoaderPath from the target partition directly,
+ * after loading the file system driver from DriverPath on our boot partition,
+ * so that they get written once the bootloader has started. DriverPath must
+ * only be NULL if the firmware can read the target without our driver. This can
+ * be called again, to replace the options, if we have to start the bootloader
+ * another way. Setting the "EnableBootOptions" UINT8 variable under our vendor
+ * GUID to a nonzero value enables this, and setting it to zero removes any
+ * option we previously created.
+ */
+VOID PrepareBootOptions(CONST EFI_HANDLE BootDeviceHandle, CONST CHAR16* DriverPath,
+	CONST EFI_HANDLE TargetHandle, CONST CHAR16* LoaderPath, CONST CHAR16* FsName)
+{
+	EFI_STATUS Status;
+	EFI_DEVICE_PATH* DevicePath;
+	CHAR16 Description[64];
+	UINT8 *DriverOption = NULL, *BootOption = NULL, Enable;
+	UINTN DriverOptionSize = 0, BootOptionSize = 0, Size = sizeof(Enable);
+	BOOLEAN Fallback = FALSE;
+
+	if (gRT->GetVariable(L"EnableBootOptions", &gUefiNtfsVariableGuid, NULL, &Size, &Enable) != EFI_SUCCESS)
+		return;
+	DiscardPendingWrites();
+
+	if (Enable != 0) {
+		DevicePath = (DriverPath == NULL) ? NULL : FileDevicePath(BootDeviceHandle, DriverPath);
+		if (DevicePath != NULL) {
+			UnicodeSPrint(Description, sizeof(Description), L"UEFI:NTFS %s driver", FsName);
+			DriverOption = CreateLoadOption(LOAD_OPTION_ACTIVE | LOAD_OPTION_FORCE_RECONNECT,
+				Description, DevicePath, &DriverOptionSize);
+			SafeFree(DevicePath);
+		}
+		DevicePath = FileDevicePath(TargetHandle, LoaderPath);
+		if (DevicePath != NULL) {
+			UnicodeSPrint(Description, sizeof(Description), L"UEFI:NTFS %s boot", FsName);
+			BootOption = CreateLoadOption(LOAD_OPTION_ACTIVE, Description, DevicePath, &BootOptionSize);
+			SafeFree(DevicePath);
+		}
+		// Don't register a boot option without the driver option it needs
+		if (((DriverPath != NULL) && (DriverOption == NULL)) || (BootOption == NULL)) {
+			PrintWarning(L"Could not create boot options");
+			goto out;
+		}
+		Fallback = IsFallbackBoot();
+		if (Fallback)
+			PrintWarning(L"The firmware could not use our boot option, moving it to the end of the boot order");
+	}
+
+	Status = QueueLoadOption(L"Driver", DriverOption, DriverOptionSize, FALSE);
+	if (!EFI_ERROR(Status))
+		Status = QueueLoadOption(L"Boot", BootOption, BootOptionSize, Fallback);
+	if (EFI_ERROR(Status)) {
+		PrintWarning(L"Could not update boot options: %r", Status);
+		DiscardPendingWrites();
+		goto out;
+	}
+
+	// Removing our options doesn't need to wait for the bootloader
+	if (Enable == 0) {
+		WritePendingWrites();
+		DiscardPendingWrites();
+		goto out;
+	}
+	if (BootOptions.ExitBootServicesEvent == NULL) {
+		Status = gBS->CreateEvent(EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_CALLBACK, OnExitBootServices, NULL,
+			&BootOptions.ExitBootServicesEvent);
+		if (EFI_ERROR(Status)) {
+			PrintWarning(L"Could not create boot options event: %r", Status);
+			DiscardPendingWrites();
+		}
+	}
+
+out:
+	SafeFree(DriverOption);
+	SafeFree(BootOption);
+}
+
+/*
+ * Write the boot options we queued if the bootloader returned successfully,
+ * unless ExitBootServices() already got us to, or discard them otherwise.
+ */
+VOID CommitBootOptions(CONST BOOLEAN Booted)
+{
+	if (BootOptions.ExitBootServicesEvent == NULL)
+		return;
+	gBS->CloseEvent(BootOptions.ExitBootServicesEvent);
+	BootOptions.ExitBootServicesEvent = NULL;
+	if (Booted)
+		WritePendingWrites();
+	DiscardPendingWrites();
+}
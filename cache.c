@@ -0,0 +1,153 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Protocol and driver cache
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/* Number of driver handles we keep information about */
+#define DRIVER_CACHE_ENTRIES    16
+
+typedef struct {
+	EFI_HANDLE Handle;
+	CHAR16* Name;
+	EFI_DRIVER_BINDING_PROTOCOL* DriverBinding;
+} DRIVER_CACHE_ENTRY;
+
+/*
+ * Reporting and driver management look up the same protocols, on the same
+ * handles, over and over, so we keep what we found for the duration of the
+ * boot. The names and interfaces we keep belong to the drivers, so the entries
+ * of a driver must be dropped whenever it may have gone away, which is why
+ * unloading and disconnecting drivers must be done through the calls below.
+ * Everything else, such as the DevicePathToText protocol, is kept.
+ * Open protocol information is not cached, since every connection alters it.
+ */
+STATIC struct {
+	BOOLEAN DevicePathToTextLocated;
+	EFI_DEVICE_PATH_TO_TEXT_PROTOCOL* DevicePathToText;
+	UINTN DriverNext;
+	DRIVER_CACHE_ENTRY Driver[DRIVER_CACHE_ENTRIES];
+} Cache = { 0 };
+
+/*
+ * Return the cached entry for a driver handle, looking the driver up if needed.
+ */
+STATIC CONST DRIVER_CACHE_ENTRY* GetDriverEntry(CONST EFI_HANDLE DriverHandle)
+{
+	DRIVER_CACHE_ENTRY* Entry;
+#if !defined(NO_DRIVER_NAME)
+	EFI_COMPONENT_NAME_PROTOCOL *ComponentName;
+	EFI_COMPONENT_NAME2_PROTOCOL *ComponentName2;
+#endif
+	UINTN i;
+
+	for (i = 0; i < ARRAY_SIZE(Cache.Driver); i++) {
+		if ((Cache.Driver[i].Handle != NULL) && (Cache.Driver[i].Handle == DriverHandle))
+			return &Cache.Driver[i];
+	}
+
+	// Replace the oldest entry when we're full
+	Entry = &Cache.Driver[Cache.DriverNext];
+	Cache.DriverNext = (Cache.DriverNext + 1) % ARRAY_SIZE(Cache.Driver);
+	Entry->Handle = DriverHandle;
+	Entry->Name = NULL;
+	Entry->DriverBinding = NULL;
+
+#if !defined(NO_DRIVER_NAME)
+	// Try EFI_COMPONENT_NAME2 protocol first
+	if ( (gBS->OpenProtocol(DriverHandle, &gEfiComponentName2ProtocolGuid, (VOID**)&ComponentName2,
+			MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL) != EFI_SUCCESS) ||
+		 (ComponentName2->GetDriverName(ComponentName2, ComponentName2->SupportedLanguages, &Entry->Name) != EFI_SUCCESS)) {
+		// Fallback to EFI_COMPONENT_NAME if that didn't work
+		if ( (gBS->OpenProtocol(DriverHandle, &gEfiComponentNameProtocolGuid, (VOID**)&ComponentName,
+				MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL) != EFI_SUCCESS) ||
+			 (ComponentName->GetDriverName(ComponentName, ComponentName->SupportedLanguages, &Entry->Name) != EFI_SUCCESS))
+			Entry->Name = NULL;
+	}
+#endif
+
+	if (gBS->OpenProtocol(DriverHandle, &gEfiDriverBindingProtocolGuid, (VOID**)&Entry->DriverBinding,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL) != EFI_SUCCESS)
+		Entry->DriverBinding = NULL;
+
+	return Entry;
+}
+
+/* Get the driver name from a driver handle */
+CHAR16* GetDriverName(CONST EFI_HANDLE DriverHandle)
+{
+	CONST DRIVER_CACHE_ENTRY* Entry = GetDriverEntry(DriverHandle);
+
+	return (Entry->Name == NULL) ? L"(unknown driver)" : Entry->Name;
+}
+
+/* Get the driver binding protocol of a driver handle, or NULL if it has none */
+EFI_DRIVER_BINDING_PROTOCOL* GetDriverBinding(CONST EFI_HANDLE DriverHandle)
+{
+	return GetDriverEntry(DriverHandle)->DriverBinding;
+}
+
+/* Get the DevicePathToText protocol, or NULL if the firmware doesn't provide it */
+EFI_DEVICE_PATH_TO_TEXT_PROTOCOL* GetDevicePathToText(VOID)
+{
+	if (!Cache.DevicePathToTextLocated) {
+		if (gBS->LocateProtocol(&gEfiDevicePathToTextProtocolGuid, NULL,
+			(VOID**)&Cache.DevicePathToText) != EFI_SUCCESS)
+			Cache.DevicePathToText = NULL;
+		Cache.DevicePathToTextLocated = TRUE;
+	}
+	return Cache.DevicePathToText;
+}
+
+/*
+ * Drop the entries of a driver handle, along with those of the drivers that
+ * were produced by Handle, if it is an image. This must be called while the
+ * driver binding protocols we kept are still valid.
+ */
+STATIC VOID InvalidateCache(CONST EFI_HANDLE Handle)
+{
+	UINTN i;
+
+	if (Handle == NULL)
+		return;
+	for (i = 0; i < ARRAY_SIZE(Cache.Driver); i++) {
+		if ((Cache.Driver[i].Handle == Handle) || ((Cache.Driver[i].DriverBinding != NULL) &&
+			(Cache.Driver[i].DriverBinding->ImageHandle == Handle)))
+			ZeroMem(&Cache.Driver[i], sizeof(Cache.Driver[i]));
+	}
+}
+
+/*
+ * Unload a driver image.
+ */
+EFI_STATUS UnloadDriverImage(CONST EFI_HANDLE ImageHandle)
+{
+	// The driver binding protocols go away with the image
+	InvalidateCache(ImageHandle);
+	return gBS->UnloadImage(ImageHandle);
+}
+
+/*
+ * Disconnect a driver, or all drivers if DriverHandle is NULL, from a controller.
+ */
+EFI_STATUS DisconnectDriver(CONST EFI_HANDLE ControllerHandle, CONST EFI_HANDLE DriverHandle)
+{
+	EFI_STATUS Status = gBS->DisconnectController(ControllerHandle, DriverHandle, NULL);
+
+	InvalidateCache(DriverHandle);
+	return Status;
+}
@@ -0,0 +1,576 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Minimal read-only exFAT reader
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/*
+ * exFAT on-disk structures, as described in the Microsoft specifications at:
+ * https://learn.microsoft.com/en-us/windows/win32/fileio/exfat-specification
+ */
+#pragma pack(push, 1)
+typedef struct {
+	UINT8  JumpBoot[3];
+	CHAR8  FileSystemName[8];
+	UINT8  MustBeZero[53];
+	UINT64 PartitionOffset;
+	UINT64 VolumeLength;
+	UINT32 FatOffset;
+	UINT32 FatLength;
+	UINT32 ClusterHeapOffset;
+	UINT32 ClusterCount;
+	UINT32 FirstClusterOfRootDirectory;
+	UINT32 VolumeSerialNumber;
+	UINT16 FileSystemRevision;
+	UINT16 VolumeFlags;
+	UINT8  BytesPerSectorShift;
+	UINT8  SectorsPerClusterShift;
+	UINT8  NumberOfFats;
+	UINT8  DriveSelect;
+	UINT8  PercentInUse;
+	UINT8  Reserved[7];
+} EXFAT_BOOT_SECTOR;
+
+typedef struct {
+	UINT8  EntryType;
+	UINT8  SecondaryCount;
+	UINT16 SetChecksum;
+	UINT16 FileAttributes;
+	UINT8  Reserved[26];
+} EXFAT_FILE_ENTRY;
+
+typedef struct {
+	UINT8  EntryType;
+	UINT8  GeneralSecondaryFlags;
+	UINT8  Reserved1;
+	UINT8  NameLength;
+	UINT16 NameHash;
+	UINT16 Reserved2;
+	UINT64 ValidDataLength;
+	UINT32 Reserved3;
+	UINT32 FirstCluster;
+	UINT64 DataLength;
+} EXFAT_STREAM_ENTRY;
+
+typedef struct {
+	UINT8  EntryType;
+	UINT8  GeneralSecondaryFlags;
+	CHAR16 FileName[15];
+} EXFAT_NAME_ENTRY;
+
+typedef struct {
+	UINT8  EntryType;
+	UINT8  Reserved1[3];
+	UINT32 TableChecksum;
+	UINT8  Reserved2[12];
+	UINT32 FirstCluster;
+	UINT64 DataLength;
+} EXFAT_UPCASE_ENTRY;
+#pragma pack(pop)
+
+#define EXFAT_ENTRY_SIZE            32
+#define EXFAT_ENTRY_END             0x00
+#define EXFAT_ENTRY_UPCASE          0x82
+#define EXFAT_ENTRY_FILE            0x85
+#define EXFAT_ENTRY_STREAM          0xC0
+#define EXFAT_ENTRY_NAME            0xC1
+#define EXFAT_NAME_CHARS            ARRAY_SIZE(((EXFAT_NAME_ENTRY*)0)->FileName)
+#define EXFAT_ATTR_DIRECTORY        0x10
+#define EXFAT_FLAG_NO_FAT_CHAIN     0x02
+#define EXFAT_FIRST_CLUSTER         2
+#define EXFAT_BAD_CLUSTER           0xFFFFFFF7
+#define EXFAT_FAT_CACHE_ENTRIES     1024
+#define EXFAT_FAT_CACHE_EMPTY       0xFFFFFFFF
+
+/* We don't expect to ever have to deal with a bootloader that is larger than this */
+#define EXFAT_MAX_FILE_SIZE         (64 * 1024 * 1024)
+
+typedef struct {
+	EFI_DISK_IO_PROTOCOL* DiskIo;
+	UINT32 MediaId;
+	UINT8  ClusterShift;
+	UINT32 ClusterCount;
+	UINT32 RootCluster;
+	UINT64 FatOffset;
+	UINT64 HeapOffset;
+	CHAR16* UpCase;
+	UINT32 FatCacheStart;
+	UINT32 FatCache[EXFAT_FAT_CACHE_ENTRIES];
+} EXFAT_VOLUME;
+
+/* Convert a character to uppercase, using the volume's table if we have it */
+STATIC __inline CHAR16 ExFatUpCase(CONST EXFAT_VOLUME* Volume, CONST CHAR16 c)
+{
+	if (Volume->UpCase != NULL)
+		return Volume->UpCase[c];
+	return (('a' <= c) && (c <= 'z')) ? (c - 'a' + 'A') : c;
+}
+
+/* Compute the name hash an exFAT stream entry would have for Name */
+STATIC UINT16 ExFatNameHash(CONST EXFAT_VOLUME* Volume, CONST CHAR16* Name, CONST UINTN Len)
+{
+	UINT16 Hash = 0;
+	CHAR16 c;
+	UINTN i;
+
+	for (i = 0; i < Len; i++) {
+		c = ExFatUpCase(Volume, Name[i]);
+		Hash = ((Hash & 1) ? 0x8000 : 0) + (Hash >> 1) + (UINT16)(c & 0xFF);
+		Hash = ((Hash & 1) ? 0x8000 : 0) + (Hash >> 1) + (UINT16)(c >> 8);
+	}
+	return Hash;
+}
+
+/* Read the FAT entry for a cluster, through a small FAT window cache */
+STATIC EFI_STATUS ExFatGetNextCluster(EXFAT_VOLUME* Volume, CONST UINT32 Cluster, UINT32* Next)
+{
+	EFI_STATUS Status;
+	UINT32 Start;
+
+	if ((Cluster < EXFAT_FIRST_CLUSTER) || (Cluster >= Volume->ClusterCount + EXFAT_FIRST_CLUSTER))
+		return EFI_VOLUME_CORRUPTED;
+
+	Start = Cluster - (Cluster % EXFAT_FAT_CACHE_ENTRIES);
+	if (Start != Volume->FatCacheStart) {
+		Status = Volume->DiskIo->ReadDisk(Volume->DiskIo, Volume->MediaId,
+			Volume->FatOffset + (UINT64)Start * sizeof(UINT32), sizeof(Volume->FatCache), Volume->FatCache);
+		if (EFI_ERROR(Status)) {
+			Volume->FatCacheStart = EXFAT_FAT_CACHE_EMPTY;
+			return Status;
+		}
+		Volume->FatCacheStart = Start;
+	}
+	*Next = Volume->FatCache[Cluster - Start];
+	return EFI_SUCCESS;
+}
+
+/* Return the size, in bytes, of a FAT chained cluster allocation */
+STATIC EFI_STATUS ExFatGetChainSize(EXFAT_VOLUME* Volume, UINT32 Cluster, UINT64* Size)
+{
+	EFI_STATUS Status;
+	UINT32 Count;
+
+	for (Count = 1; Count <= Volume->ClusterCount; Count++) {
+		Status = ExFatGetNextCluster(Volume, Cluster, &Cluster);
+		if (EFI_ERROR(Status))
+			return Status;
+		if (Cluster >= EXFAT_BAD_CLUSTER) {
+			*Size = (UINT64)Count << Volume->ClusterShift;
+			return EFI_SUCCESS;
+		}
+	}
+	// Looping chain
+	return EFI_VOLUME_CORRUPTED;
+}
+
+/*
+ * Get the number of clusters that are contiguous on disk from Cluster, up to
+ * the ones needed to hold Size bytes, along with the cluster that follows them.
+ */
+STATIC EFI_STATUS ExFatGetRun(EXFAT_VOLUME* Volume, CONST UINT32 Cluster,
+	CONST BOOLEAN NoFatChain, CONST UINT64 Size, UINT32* Run, UINT32* Next)
+{
+	EFI_STATUS Status;
+
+	if ((Cluster < EXFAT_FIRST_CLUSTER) || (Cluster >= Volume->ClusterCount + EXFAT_FIRST_CLUSTER))
+		return EFI_VOLUME_CORRUPTED;
+	if (NoFatChain) {
+		*Run = Volume->ClusterCount + EXFAT_FIRST_CLUSTER - Cluster;
+		*Next = Cluster + *Run;
+		return EFI_SUCCESS;
+	}
+	for (*Run = 1; ; (*Run)++) {
+		Status = ExFatGetNextCluster(Volume, Cluster + *Run - 1, Next);
+		if (EFI_ERROR(Status))
+			return Status;
+		if ((*Next != Cluster + *Run) || (((UINT64)*Run << Volume->ClusterShift) >= Size))
+			break;
+	}
+	return EFI_SUCCESS;
+}
+
+/*
+ * Read Size bytes of data from a cluster allocation. Clusters that are contiguous
+ * on disk are coalesced, so that unfragmented data is read with a single call.
+ */
+STATIC EFI_STATUS ExFatReadData(EXFAT_VOLUME* Volume, UINT32 Cluster,
+	CONST BOOLEAN NoFatChain, CONST UINTN Size, UINT8* Data)
+{
+	EFI_STATUS Status;
+	UINT32 Run, Next;
+	UINTN Offset, Len;
+
+	for (Offset = 0; Offset < Size; Offset += Len) {
+		Status = ExFatGetRun(Volume, Cluster, NoFatChain, Size - Offset, &Run, &Next);
+		if (EFI_ERROR(Status))
+			return Status;
+		Len = (((UINT64)Run << Volume->ClusterShift) < Size - Offset) ?
+			(UINTN)((UINT64)Run << Volume->ClusterShift) : Size - Offset;
+		Status = Volume->DiskIo->ReadDisk(Volume->DiskIo, Volume->MediaId,
+			Volume->HeapOffset + ((UINT64)(Cluster - EXFAT_FIRST_CLUSTER) << Volume->ClusterShift),
+			Len, &Data[Offset]);
+		if (EFI_ERROR(Status))
+			return Status;
+		Cluster = Next;
+	}
+	return EFI_SUCCESS;
+}
+
+/*
+ * Map Size bytes of data from a cluster allocation to the extents of the
+ * partition that hold them. If Extents is NULL, only count the extents.
+ */
+STATIC EFI_STATUS ExFatMapData(EXFAT_VOLUME* Volume, UINT32 Cluster,
+	CONST BOOLEAN NoFatChain, CONST UINT64 Size, FILE_EXTENT* Extents, UINTN* ExtentCount)
+{
+	EFI_STATUS Status;
+	UINT32 Run, Next;
+	UINT64 Offset, Len;
+	UINTN Count;
+
+	for (Offset = 0, Count = 0; Offset < Size; Offset += Len, Count++) {
+		Status = ExFatGetRun(Volume, Cluster, NoFatChain, Size - Offset, &Run, &Next);
+		if (EFI_ERROR(Status))
+			return Status;
+		Len = (((UINT64)Run << Volume->ClusterShift) < Size - Offset) ?
+			((UINT64)Run << Volume->ClusterShift) : Size - Offset;
+		if (Extents != NULL) {
+			Extents[Count].FileOffset = Offset;
+			Extents[Count].DiskOffset = Volume->HeapOffset +
+				((UINT64)(Cluster - EXFAT_FIRST_CLUSTER) << Volume->ClusterShift);
+			Extents[Count].Length = Len;
+		}
+		Cluster = Next;
+	}
+	*ExtentCount = Count;
+	return EFI_SUCCESS;
+}
+
+/*
+ * Read a complete directory in memory. A zero DataLength indicates that the
+ * size should be obtained from the FAT (which is always the case for root).
+ * The returned buffer must be freed by the caller.
+ */
+STATIC EFI_STATUS ExFatReadDirectory(EXFAT_VOLUME* Volume, CONST UINT32 Cluster,
+	CONST BOOLEAN NoFatChain, UINT64 DataLength, UINT8** Dir, UINTN* DirSize)
+{
+	EFI_STATUS Status;
+
+	if (DataLength == 0) {
+		Status = ExFatGetChainSize(Volume, Cluster, &DataLength);
+		if (EFI_ERROR(Status))
+			return Status;
+	}
+	if (DataLength > EXFAT_MAX_FILE_SIZE)
+		return EFI_UNSUPPORTED;
+
+	*DirSize = (UINTN)DataLength;
+	*Dir = ArenaAllocate(*DirSize);
+	if (*Dir == NULL)
+		return EFI_OUT_OF_RESOURCES;
+	Status = ExFatReadData(Volume, Cluster, NoFatChain, *DirSize, *Dir);
+	if (EFI_ERROR(Status))
+		SafeArenaFree(*Dir);
+	return Status;
+}
+
+/*
+ * Load and decompress the volume's up-case table. Failure is not fatal,
+ * as we can still fall back to ASCII case insensitive comparison.
+ */
+STATIC VOID ExFatLoadUpCase(EXFAT_VOLUME* Volume, CONST EXFAT_UPCASE_ENTRY* Entry)
+{
+	CHAR16* Raw;
+	UINTN i, Len, Count;
+	UINT32 c = 0;
+
+	if ((Entry->DataLength < sizeof(CHAR16)) || (Entry->DataLength > 0x10000 * sizeof(CHAR16)))
+		return;
+	Len = (UINTN)Entry->DataLength / sizeof(CHAR16);
+	Raw = ArenaAllocate(Len * sizeof(CHAR16));
+	if (Raw == NULL)
+		return;
+	Volume->UpCase = ArenaAllocate(0x10000 * sizeof(CHAR16));
+	if ((Volume->UpCase == NULL) ||
+		(ExFatReadData(Volume, Entry->FirstCluster, FALSE, Len * sizeof(CHAR16), (UINT8*)Raw) != EFI_SUCCESS)) {
+		SafeArenaFree(Volume->UpCase);
+		SafeArenaFree(Raw);
+		return;
+	}
+
+	// 0xFFFF followed by a count denotes a range of characters that map to themselves
+	for (i = 0; (i < Len) && (c < 0x10000); i++) {
+		if ((Raw[i] == 0xFFFF) && (i + 1 < Len)) {
+			for (Count = Raw[++i]; (Count > 0) && (c < 0x10000); Count--, c++)
+				Volume->UpCase[c] = (CHAR16)c;
+		} else {
+			Volume->UpCase[c++] = Raw[i];
+		}
+	}
+	for (; c < 0x10000; c++)
+		Volume->UpCase[c] = (CHAR16)c;
+	SafeArenaFree(Raw);
+}
+
+/*
+ * Look for a case insensitive Name (of Len characters) in a directory.
+ * On success, the stream entry for the file is returned and the
+ * characters from Name are replaced with the ones from the file system.
+ */
+STATIC EFI_STATUS ExFatFindEntry(CONST EXFAT_VOLUME* Volume, CONST UINT8* Dir, CONST UINTN DirSize,
+	CHAR16* Name, CONST UINTN Len, EXFAT_STREAM_ENTRY* Stream, UINT16* Attributes)
+{
+	CONST EXFAT_FILE_ENTRY* File;
+	CONST EXFAT_STREAM_ENTRY* Entry;
+	CONST EXFAT_NAME_ENTRY* NameEntry;
+	UINT16 Hash = ExFatNameHash(Volume, Name, Len);
+	UINTN i, j, SetSize;
+
+	for (i = 0; i + EXFAT_ENTRY_SIZE <= DirSize; i += EXFAT_ENTRY_SIZE) {
+		if (Dir[i] == EXFAT_ENTRY_END)
+			break;
+		if (Dir[i] != EXFAT_ENTRY_FILE)
+			continue;
+		File = (CONST EXFAT_FILE_ENTRY*)&Dir[i];
+		SetSize = ((UINTN)File->SecondaryCount + 1) * EXFAT_ENTRY_SIZE;
+		Entry = (CONST EXFAT_STREAM_ENTRY*)&Dir[i + EXFAT_ENTRY_SIZE];
+		if ((File->SecondaryCount < 2) || (i + SetSize > DirSize) || (Entry->EntryType != EXFAT_ENTRY_STREAM))
+			continue;
+		// The hash lets us skip most entries without looking at their names
+		if ((Entry->NameLength != Len) || (Entry->NameHash != Hash) ||
+			((Len + EXFAT_NAME_CHARS - 1) / EXFAT_NAME_CHARS > (UINTN)File->SecondaryCount - 1))
+			continue;
+		for (j = 0; j < Len; j++) {
+			NameEntry = (CONST EXFAT_NAME_ENTRY*)&Dir[i + (2 + j / EXFAT_NAME_CHARS) * EXFAT_ENTRY_SIZE];
+			if ((NameEntry->EntryType != EXFAT_ENTRY_NAME) ||
+				(ExFatUpCase(Volume, NameEntry->FileName[j % EXFAT_NAME_CHARS]) != ExFatUpCase(Volume, Name[j])))
+				break;
+		}
+		if (j != Len)
+			continue;
+		// Match => fix the case
+		for (j = 0; j < Len; j++) {
+			NameEntry = (CONST EXFAT_NAME_ENTRY*)&Dir[i + (2 + j / EXFAT_NAME_CHARS) * EXFAT_ENTRY_SIZE];
+			Name[j] = NameEntry->FileName[j % EXFAT_NAME_CHARS];
+		}
+		CopyMem(Stream, Entry, sizeof(EXFAT_STREAM_ENTRY));
+		*Attributes = File->FileAttributes;
+		return EFI_SUCCESS;
+	}
+	return EFI_NOT_FOUND;
+}
+
+/*
+ * Free a volume opened by ExFatOpenFile().
+ */
+STATIC VOID ExFatCloseVolume(EXFAT_VOLUME* Volume)
+{
+	SafeArenaFree(Volume->UpCase);
+	SafeArenaFree(Volume);
+}
+
+/*
+ * Open the exFAT volume on Handle and look up the file at Path. On success,
+ * the case of Path is corrected, Stream is set to the stream entry of the
+ * file, and the volume must be freed with ExFatCloseVolume().
+ */
+STATIC EFI_STATUS ExFatOpenFile(CONST EFI_HANDLE Handle, CONST VOID* BootSector,
+	CHAR16* Path, EXFAT_VOLUME** VolumePtr, EXFAT_STREAM_ENTRY* Stream)
+{
+	CONST EXFAT_BOOT_SECTOR* Vbr = (CONST EXFAT_BOOT_SECTOR*)BootSector;
+	EFI_STATUS Status;
+	EFI_BLOCK_IO_PROTOCOL* BlockIo;
+	EXFAT_VOLUME* Volume;
+	UINT16 Attributes = EXFAT_ATTR_DIRECTORY;
+	UINT8* Dir = NULL;
+	UINTN i, Start, DirSize = 0;
+
+	if ((BootSector == NULL) || (Path == NULL) || (Path[0] != L'\\'))
+		return EFI_INVALID_PARAMETER;
+
+	// Validate the parts of the boot sector we use
+	if ((CompareMem(Vbr->FileSystemName, "EXFAT   ", sizeof(Vbr->FileSystemName)) != 0) ||
+		(Vbr->BytesPerSectorShift < 9) || (Vbr->BytesPerSectorShift > 12) ||
+		(Vbr->SectorsPerClusterShift > 25 - Vbr->BytesPerSectorShift) ||
+		(Vbr->NumberOfFats == 0) || (Vbr->NumberOfFats > 2) || (Vbr->ClusterCount == 0))
+		return EFI_UNSUPPORTED;
+
+	Volume = ArenaAllocateZero(sizeof(EXFAT_VOLUME));
+	if (Volume == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	Status = gBS->OpenProtocol(Handle, &gEfiBlockIoProtocolGuid, (VOID**)&BlockIo,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (EFI_ERROR(Status))
+		goto out;
+	Status = gBS->OpenProtocol(Handle, &gEfiDiskIoProtocolGuid, (VOID**)&Volume->DiskIo,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (EFI_ERROR(Status))
+		goto out;
+
+	Volume->MediaId = BlockIo->Media->MediaId;
+	Volume->ClusterShift = Vbr->BytesPerSectorShift + Vbr->SectorsPerClusterShift;
+	Volume->ClusterCount = Vbr->ClusterCount;
+	Volume->RootCluster = Vbr->FirstClusterOfRootDirectory;
+	// Bit 0 of the volume flags indicates which FAT is active
+	Volume->FatOffset = ((UINT64)Vbr->FatOffset +
+		(((Vbr->VolumeFlags & 1) && (Vbr->NumberOfFats == 2)) ? Vbr->FatLength : 0)) << Vbr->BytesPerSectorShift;
+	Volume->HeapOffset = (UINT64)Vbr->ClusterHeapOffset << Vbr->BytesPerSectorShift;
+	Volume->FatCacheStart = EXFAT_FAT_CACHE_EMPTY;
+
+	Status = ExFatReadDirectory(Volume, Volume->RootCluster, FALSE, 0, &Dir, &DirSize);
+	if (EFI_ERROR(Status))
+		goto out;
+
+	// The up-case table is always located in the root directory
+	for (i = 0; (i + EXFAT_ENTRY_SIZE <= DirSize) && (Dir[i] != EXFAT_ENTRY_END); i += EXFAT_ENTRY_SIZE) {
+		if (Dir[i] == EXFAT_ENTRY_UPCASE) {
+			ExFatLoadUpCase(Volume, (CONST EXFAT_UPCASE_ENTRY*)&Dir[i]);
+			break;
+		}
+	}
+
+	// Walk the path, one element at a time
+	for (Start = 1; ; Start = i + 1) {
+		for (i = Start; (Path[i] != 0) && (Path[i] != L'\\'); i++);
+		if ((i == Start) || (!(Attributes & EXFAT_ATTR_DIRECTORY))) {
+			Status = EFI_NOT_FOUND;
+			goto out;
+		}
+		Status = ExFatFindEntry(Volume, Dir, DirSize, &Path[Start], i - Start, Stream, &Attributes);
+		SafeArenaFree(Dir);
+		if (EFI_ERROR(Status))
+			goto out;
+		if (Path[i] == 0)
+			break;
+		if (!(Attributes & EXFAT_ATTR_DIRECTORY)) {
+			Status = EFI_NOT_FOUND;
+			goto out;
+		}
+		Status = ExFatReadDirectory(Volume, Stream->FirstCluster,
+			(Stream->GeneralSecondaryFlags & EXFAT_FLAG_NO_FAT_CHAIN), Stream->DataLength, &Dir, &DirSize);
+		if (EFI_ERROR(Status))
+			goto out;
+	}
+
+	if ((Attributes & EXFAT_ATTR_DIRECTORY) || (Stream->DataLength == 0) ||
+		(Stream->ValidDataLength > Stream->DataLength))
+		Status = EFI_NOT_FOUND;
+
+out:
+	SafeArenaFree(Dir);
+	if (EFI_ERROR(Status))
+		ExFatCloseVolume(Volume);
+	else
+		*VolumePtr = Volume;
+	return Status;
+}
+
+/*
+ * Read a file from an exFAT partition, without using an exFAT file system driver.
+ * Arguments:
+ *  Handle          - Handle of the exFAT partition (must provide BlockIo and DiskIo)
+ *  BootSector      - The first block of the partition, as read during detection
+ *  Path            - Absolute path of the file to read. Its case is corrected on success.
+ *  Data            - Returned file content. Must be freed with ArenaFree() on success.
+ *  DataSize        - Returned size of the file.
+ */
+EFI_STATUS ExFatReadFile(CONST EFI_HANDLE Handle, CONST VOID* BootSector,
+	CHAR16* Path, VOID** Data, UINTN* DataSize)
+{
+	EFI_STATUS Status;
+	EXFAT_VOLUME* Volume;
+	EXFAT_STREAM_ENTRY Stream = { 0 };
+
+	if ((Data == NULL) || (DataSize == NULL))
+		return EFI_INVALID_PARAMETER;
+	Status = ExFatOpenFile(Handle, BootSector, Path, &Volume, &Stream);
+	if (EFI_ERROR(Status))
+		return Status;
+
+	if (Stream.DataLength > EXFAT_MAX_FILE_SIZE) {
+		Status = EFI_UNSUPPORTED;
+		goto out;
+	}
+
+	// Data past ValidDataLength is undefined on disk and must be read as zeroes
+	*DataSize = (UINTN)Stream.DataLength;
+	*Data = ArenaAllocateZero(*DataSize);
+	if (*Data == NULL) {
+		Status = EFI_OUT_OF_RESOURCES;
+		goto out;
+	}
+	Status = ExFatReadData(Volume, Stream.FirstCluster, (Stream.GeneralSecondaryFlags & EXFAT_FLAG_NO_FAT_CHAIN),
+		(UINTN)Stream.ValidDataLength, *Data);
+	if (EFI_ERROR(Status))
+		SafeArenaFree(*Data);
+
+out:
+	ExFatCloseVolume(Volume);
+	return Status;
+}
+
+/*
+ * Map a file from an exFAT partition to the extents of the partition that
+ * hold its data, so that it can be read with DiskIo without going through
+ * a file system driver.
+ * Arguments:
+ *  Handle          - Handle of the exFAT partition (must provide BlockIo and DiskIo)
+ *  BootSector      - The first block of the partition, as read during detection
+ *  Path            - Absolute path of the file to map. Its case is corrected on success.
+ *  Extents         - Returned extents, in file order. Must be freed with FreePool() on success.
+ *                    Data that isn't covered by an extent must be read as zeroes.
+ *                    Unlike our other allocations, these come from the pool, since
+ *                    they must outlive the arena when a disk image is mounted.
+ *  ExtentCount     - Returned number of extents.
+ *  FileSize        - Returned size of the file.
+ */
+EFI_STATUS ExFatGetFileExtents(CONST EFI_HANDLE Handle, CONST VOID* BootSector,
+	CHAR16* Path, FILE_EXTENT** Extents, UINTN* ExtentCount, UINT64* FileSize)
+{
+	EFI_STATUS Status;
+	EXFAT_VOLUME* Volume;
+	EXFAT_STREAM_ENTRY Stream = { 0 };
+	BOOLEAN NoFatChain;
+
+	if ((Extents == NULL) || (ExtentCount == NULL) || (FileSize == NULL))
+		return EFI_INVALID_PARAMETER;
+	Status = ExFatOpenFile(Handle, BootSector, Path, &Volume, &Stream);
+	if (EFI_ERROR(Status))
+		return Status;
+
+	// Count the extents first, so that we don't have to grow the array
+	NoFatChain = (Stream.GeneralSecondaryFlags & EXFAT_FLAG_NO_FAT_CHAIN);
+	Status = ExFatMapData(Volume, Stream.FirstCluster, NoFatChain, Stream.ValidDataLength, NULL, ExtentCount);
+	if (EFI_ERROR(Status))
+		goto out;
+	*Extents = AllocatePool((*ExtentCount + 1) * sizeof(FILE_EXTENT));
+	if (*Extents == NULL) {
+		Status = EFI_OUT_OF_RESOURCES;
+		goto out;
+	}
+	Status = ExFatMapData(Volume, Stream.FirstCluster, NoFatChain, Stream.ValidDataLength, *Extents, ExtentCount);
+	if (EFI_ERROR(Status)) {
+		SafeFree(*Extents);
+		goto out;
+	}
+	*FileSize = Stream.DataLength;
+
+out:
+	ExFatCloseVolume(Volume);
+	return Status;
+}
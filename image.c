@@ -0,0 +1,359 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Disk images
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+#if !defined(NO_DISK_IMAGE)
+
+/* Block size of the disks we expose, which is what VHD and raw images use */
+#define IMAGE_BLOCK_SIZE        512
+
+/* Vendor GUID for the device path node that we append to the host partition's */
+#define DISK_IMAGE_GUID \
+	{ 0x3a9f0c2e, 0x6d41, 0x4b8a, { 0x9e, 0x27, 0x51, 0xc4, 0x08, 0xd3, 0x7b, 0x16 } }
+
+/*
+ * The part of the VHD footer that we need, as described in the Microsoft
+ * Virtual Hard Disk Image Format Specification. Fields are big endian.
+ */
+#pragma pack(push, 1)
+typedef struct {
+	CHAR8  Cookie[8];
+	UINT8  Unused[0x34];
+	UINT8  DiskType[4];
+} VHD_FOOTER;
+#pragma pack(pop)
+
+#define VHD_FOOTER_SIZE         512
+#define VHD_TYPE_FIXED          2
+
+/*
+ * We expose a disk image file, from the partition we found, as a read-only
+ * BlockIo device, so that the firmware creates the partitions it contains and
+ * we can chain load from these. When we can map the file to the extents of the
+ * host partition that hold it, which our exFAT reader can do, reads go straight
+ * to the host's DiskIo. Otherwise they go through the file system driver.
+ * Only raw and fixed VHD images are supported, as these store the disk data
+ * as is. As the device lives in our image, it must be removed before we exit.
+ */
+STATIC struct {
+	EFI_HANDLE Handle;
+	EFI_BLOCK_IO_PROTOCOL BlockIo;
+	EFI_BLOCK_IO_MEDIA Media;
+	EFI_DEVICE_PATH* DevicePath;
+	EFI_DISK_IO_PROTOCOL* HostDiskIo;
+	UINT32 HostMediaId;
+	FILE_EXTENT* Extents;
+	UINTN ExtentCount;
+	EFI_FILE_HANDLE File;
+} DiskImage = { 0 };
+
+STATIC EFI_GUID DiskImageGuid = DISK_IMAGE_GUID;
+
+/*
+ * Read Size bytes from the image file, at Offset.
+ */
+STATIC EFI_STATUS ReadImage(UINT64 Offset, UINTN Size, UINT8* Buffer)
+{
+	EFI_STATUS Status;
+	UINTN i, Low, High, Read;
+	UINT64 Len;
+
+	if (DiskImage.Extents == NULL) {
+		Status = DiskImage.File->SetPosition(DiskImage.File, Offset);
+		if (EFI_ERROR(Status))
+			return Status;
+		Read = Size;
+		Status = DiskImage.File->Read(DiskImage.File, &Read, Buffer);
+		if (!EFI_ERROR(Status) && (Read != Size))
+			Status = EFI_DEVICE_ERROR;
+		return Status;
+	}
+
+	// Look for the first extent that ends after Offset
+	for (Low = 0, High = DiskImage.ExtentCount; Low < High; ) {
+		i = (Low + High) / 2;
+		if (DiskImage.Extents[i].FileOffset + DiskImage.Extents[i].Length <= Offset)
+			Low = i + 1;
+		else
+			High = i;
+	}
+	for (i = Low; Size > 0; Offset += Len, Buffer += Len, Size -= (UINTN)Len) {
+		if ((i < DiskImage.ExtentCount) && (Offset >= DiskImage.Extents[i].FileOffset)) {
+			Len = DiskImage.Extents[i].FileOffset + DiskImage.Extents[i].Length - Offset;
+			if (Len > Size)
+				Len = Size;
+			Status = DiskImage.HostDiskIo->ReadDisk(DiskImage.HostDiskIo, DiskImage.HostMediaId,
+				DiskImage.Extents[i].DiskOffset + (Offset - DiskImage.Extents[i].FileOffset), (UINTN)Len, Buffer);
+			if (EFI_ERROR(Status))
+				return Status;
+			i++;
+		} else {
+			// Data that isn't mapped, such as exFAT data past ValidDataLength, reads as zeroes
+			Len = ((i < DiskImage.ExtentCount) && (DiskImage.Extents[i].FileOffset - Offset < Size)) ?
+				DiskImage.Extents[i].FileOffset - Offset : Size;
+			ZeroMem(Buffer, (UINTN)Len);
+		}
+	}
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI DiskImageReset(EFI_BLOCK_IO_PROTOCOL* This, BOOLEAN ExtendedVerification)
+{
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS EFIAPI DiskImageReadBlocks(EFI_BLOCK_IO_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba,
+	UINTN BufferSize, VOID* Buffer)
+{
+	if (MediaId != DiskImage.Media.MediaId)
+		return EFI_MEDIA_CHANGED;
+	if (Buffer == NULL)
+		return EFI_INVALID_PARAMETER;
+	if (BufferSize == 0)
+		return EFI_SUCCESS;
+	if (BufferSize % IMAGE_BLOCK_SIZE != 0)
+		return EFI_BAD_BUFFER_SIZE;
+	if ((Lba > DiskImage.Media.LastBlock) || (BufferSize / IMAGE_BLOCK_SIZE > DiskImage.Media.LastBlock + 1 - Lba))
+		return EFI_INVALID_PARAMETER;
+	return ReadImage(Lba * IMAGE_BLOCK_SIZE, BufferSize, Buffer);
+}
+
+STATIC EFI_STATUS EFIAPI DiskImageWriteBlocks(EFI_BLOCK_IO_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba,
+	UINTN BufferSize, VOID* Buffer)
+{
+	return EFI_WRITE_PROTECTED;
+}
+
+STATIC EFI_STATUS EFIAPI DiskImageFlushBlocks(EFI_BLOCK_IO_PROTOCOL* This)
+{
+	return EFI_SUCCESS;
+}
+
+/*
+ * Open the image file through the file system driver of the host partition.
+ */
+STATIC EFI_STATUS OpenImageFile(CONST EFI_HANDLE HostHandle, CHAR16* Path, UINT64* Size)
+{
+	EFI_STATUS Status;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	EFI_FILE_HANDLE Root;
+
+	Status = gBS->OpenProtocol(HostHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Volume,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (EFI_ERROR(Status))
+		return Status;
+	Status = Volume->OpenVolume(Volume, &Root);
+	if (EFI_ERROR(Status))
+		return Status;
+	Status = SetPathCase(Root, Path);
+	if (!EFI_ERROR(Status))
+		Status = Root->Open(Root, &DiskImage.File, Path, EFI_FILE_MODE_READ, 0);
+	Root->Close(Root);
+	if (EFI_ERROR(Status)) {
+		DiskImage.File = NULL;
+		return Status;
+	}
+	// Seeking to the largest position moves to the end of the file
+	Status = DiskImage.File->SetPosition(DiskImage.File, (UINT64)-1);
+	if (!EFI_ERROR(Status))
+		Status = DiskImage.File->GetPosition(DiskImage.File, Size);
+	return Status;
+}
+
+/*
+ * Map the image file to the extents of the host partition, through our
+ * exFAT reader, so that it can be read without the file system driver.
+ * We have no such reader for NTFS, so images on NTFS go through the driver,
+ * with OpenImageFile() above.
+ */
+STATIC EFI_STATUS MapImageFile(CONST EFI_HANDLE HostHandle, CONST VOID* HostBootSector,
+	CHAR16* Path, UINT64* Size)
+{
+	EFI_STATUS Status;
+	EFI_BLOCK_IO_PROTOCOL* BlockIo;
+
+	Status = gBS->OpenProtocol(HostHandle, &gEfiBlockIoProtocolGuid, (VOID**)&BlockIo,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (EFI_ERROR(Status))
+		return Status;
+	Status = gBS->OpenProtocol(HostHandle, &gEfiDiskIoProtocolGuid, (VOID**)&DiskImage.HostDiskIo,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (EFI_ERROR(Status))
+		return Status;
+	DiskImage.HostMediaId = BlockIo->Media->MediaId;
+	return ExFatGetFileExtents(HostHandle, HostBootSector, Path, &DiskImage.Extents,
+		&DiskImage.ExtentCount, Size);
+}
+
+/*
+ * Check the format of the image and get the size of the disk it holds.
+ */
+STATIC EFI_STATUS GetDiskSize(UINT64* Size)
+{
+	EFI_STATUS Status;
+	CHAR8 Signature[8];
+	VHD_FOOTER Footer;
+
+	if (*Size < IMAGE_BLOCK_SIZE)
+		return EFI_UNSUPPORTED;
+	Status = ReadImage(0, sizeof(Signature), (UINT8*)Signature);
+	if (EFI_ERROR(Status))
+		return Status;
+	if (CompareMem(Signature, "vhdxfile", sizeof(Signature)) == 0) {
+		PrintError(L"  VHDX images are not supported");
+		return EFI_UNSUPPORTED;
+	}
+	Status = ReadImage(*Size - VHD_FOOTER_SIZE, sizeof(Footer), (UINT8*)&Footer);
+	if (EFI_ERROR(Status))
+		return Status;
+	if (CompareMem(Footer.Cookie, "conectix", sizeof(Footer.Cookie)) == 0) {
+		if ((Footer.DiskType[0] | Footer.DiskType[1] | Footer.DiskType[2]) != 0 ||
+			(Footer.DiskType[3] != VHD_TYPE_FIXED)) {
+			PrintError(L"  Only fixed size VHD images are supported");
+			return EFI_UNSUPPORTED;
+		}
+		*Size -= VHD_FOOTER_SIZE;
+	}
+	// Raw images that aren't a multiple of the block size have their last partial block ignored
+	*Size &= ~((UINT64)IMAGE_BLOCK_SIZE - 1);
+	return (*Size == 0) ? EFI_UNSUPPORTED : EFI_SUCCESS;
+}
+
+/*
+ * Expose the disk image at Path, on the host partition, as a BlockIo device
+ * and have the firmware connect its partitions. HostBootSector is the first
+ * block of an exFAT host partition, in which case we map the file ourselves,
+ * or NULL to read the file through the host's file system driver.
+ */
+EFI_STATUS MountDiskImage(CONST EFI_HANDLE HostHandle, CONST VOID* HostBootSector,
+	CHAR16* Path, EFI_HANDLE* DiskHandle)
+{
+	EFI_STATUS Status;
+	EFI_DEVICE_PATH* HostDevicePath;
+	VENDOR_DEVICE_PATH* Node;
+	UINT64 Size = 0;
+	UINTN Len;
+
+	if (DiskImage.Handle != NULL)
+		return EFI_ALREADY_STARTED;
+
+	PrintInfo(L"Mounting disk image '%s':", &Path[1]);
+	if (HostBootSector != NULL) {
+		Status = MapImageFile(HostHandle, HostBootSector, Path, &Size);
+		if (!EFI_ERROR(Status))
+			PrintInfo(L"  Mapped to %d extent(s)", DiskImage.ExtentCount);
+	} else {
+		Status = OpenImageFile(HostHandle, Path, &Size);
+	}
+	if (EFI_ERROR(Status)) {
+		PrintErrorStatus(L"  Could not open image");
+		goto out;
+	}
+	Status = GetDiskSize(&Size);
+	if (EFI_ERROR(Status)) {
+		PrintErrorStatus(L"  Could not use image");
+		goto out;
+	}
+
+	HostDevicePath = DevicePathFromHandle(HostHandle);
+	if (HostDevicePath == NULL) {
+		Status = EFI_NOT_FOUND;
+		PrintErrorStatus(L"  Could not get host path");
+		goto out;
+	}
+	// Our device path is the host partition's, followed by a vendor node
+	Len = GetDevicePathLength(HostDevicePath) - sizeof(EFI_DEVICE_PATH);
+	DiskImage.DevicePath = AllocatePool(Len + sizeof(VENDOR_DEVICE_PATH) + sizeof(EFI_DEVICE_PATH));
+	if (DiskImage.DevicePath == NULL) {
+		Status = EFI_OUT_OF_RESOURCES;
+		goto out;
+	}
+	CopyMem(DiskImage.DevicePath, HostDevicePath, Len);
+	Node = (VENDOR_DEVICE_PATH*)((UINT8*)DiskImage.DevicePath + Len);
+	Node->Header.Type = MEDIA_DEVICE_PATH;
+	Node->Header.SubType = MEDIA_VENDOR_DP;
+	SetDevicePathNodeLength(&Node->Header, sizeof(VENDOR_DEVICE_PATH));
+	CopyMem(&Node->Guid, &DiskImageGuid, sizeof(EFI_GUID));
+	SetDevicePathEndNode(NextDevicePathNode(&Node->Header));
+
+	ZeroMem(&DiskImage.Media, sizeof(DiskImage.Media));
+	DiskImage.Media.MediaPresent = TRUE;
+	DiskImage.Media.ReadOnly = TRUE;
+	DiskImage.Media.BlockSize = IMAGE_BLOCK_SIZE;
+	DiskImage.Media.LastBlock = (Size / IMAGE_BLOCK_SIZE) - 1;
+	DiskImage.BlockIo.Revision = EFI_BLOCK_IO_PROTOCOL_REVISION;
+	DiskImage.BlockIo.Media = &DiskImage.Media;
+	DiskImage.BlockIo.Reset = DiskImageReset;
+	DiskImage.BlockIo.ReadBlocks = DiskImageReadBlocks;
+	DiskImage.BlockIo.WriteBlocks = DiskImageWriteBlocks;
+	DiskImage.BlockIo.FlushBlocks = DiskImageFlushBlocks;
+
+	Status = gBS->InstallProtocolInterface(&DiskImage.Handle, &gEfiDevicePathProtocolGuid,
+		EFI_NATIVE_INTERFACE, DiskImage.DevicePath);
+	if (EFI_ERROR(Status)) {
+		DiskImage.Handle = NULL;
+		PrintErrorStatus(L"  Could not install device");
+		goto out;
+	}
+	Status = gBS->InstallProtocolInterface(&DiskImage.Handle, &gEfiBlockIoProtocolGuid,
+		EFI_NATIVE_INTERFACE, &DiskImage.BlockIo);
+	if (EFI_ERROR(Status)) {
+		PrintErrorStatus(L"  Could not install device");
+		goto out;
+	}
+
+	// This has the firmware add DiskIo and the partitions, along with
+	// the file system services it has native drivers for.
+	gBS->ConnectController(DiskImage.Handle, NULL, NULL, TRUE);
+	PrintInfo(L"  Exposed %ld MB disk", Size >> 20);
+	*DiskHandle = DiskImage.Handle;
+
+out:
+	if (EFI_ERROR(Status))
+		UnmountDiskImage();
+	return Status;
+}
+
+/*
+ * Remove the disk image device, along with the partitions it produced.
+ */
+VOID UnmountDiskImage(VOID)
+{
+	if (DiskImage.Handle != NULL) {
+		gBS->DisconnectController(DiskImage.Handle, NULL, NULL);
+		gBS->UninstallProtocolInterface(DiskImage.Handle, &gEfiBlockIoProtocolGuid, &DiskImage.BlockIo);
+		// If this fails, the device path must stay allocated, as the handle still references it
+		if (gBS->UninstallProtocolInterface(DiskImage.Handle, &gEfiDevicePathProtocolGuid,
+			DiskImage.DevicePath) != EFI_SUCCESS)
+			DiskImage.DevicePath = NULL;
+		DiskImage.Handle = NULL;
+	}
+	if (DiskImage.DevicePath != NULL)
+		SafeFree(DiskImage.DevicePath);
+	if (DiskImage.Extents != NULL)
+		SafeFree(DiskImage.Extents);
+	if (DiskImage.File != NULL) {
+		DiskImage.File->Close(DiskImage.File);
+		DiskImage.File = NULL;
+	}
+	DiskImage.HostDiskIo = NULL;
+	DiskImage.ExtentCount = 0;
+}
+
+#endif /* NO_DISK_IMAGE */
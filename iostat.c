@@ -0,0 +1,245 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Read statistics
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+#if !defined(NO_READ_STATS)
+
+/* Name of the variable we record the histograms to, under our vendor GUID */
+#define READ_STATS_VARIABLE     L"ReadHistogram"
+
+/* Maximum size of the recorded histograms, in characters */
+#define READ_STATS_MAX_SIZE     2048
+
+/* Upper bounds of the latency buckets, in microseconds, and of the size buckets, in bytes */
+STATIC CONST UINT32 LatencyBound[] = { 64, 256, 1000, 4000, 16000, 64000, 256000 };
+STATIC CONST UINT32 SizeBound[] = { 512, 4096, 16384, 65536, 262144, 1048576, 4194304 };
+
+typedef struct {
+	UINT64 Reads;
+	UINT64 Bytes;
+	UINT64 Ticks;
+	UINT64 Sequential;
+	UINT64 Errors;
+	UINT64 NextStart;
+	UINT32 Latency[ARRAY_SIZE(LatencyBound) + 1];
+	UINT32 Size[ARRAY_SIZE(SizeBound) + 1];
+} READ_HISTOGRAM;
+
+/*
+ * When the "ReadStats" variable exists under our vendor GUID, we hook the
+ * reads of the DiskIo and BlockIo instances of the target partition, before
+ * our file system driver gets connected, so that we see what this driver, and
+ * then the bootloader, ask of the media. Both layers are recorded, since the
+ * DiskIo reads from the driver usually reach the media as BlockIo reads of
+ * the same partition. Reads through BlockIo2, or through the instances of the
+ * whole disk, are not seen. The histograms are written to a variable from an
+ * ExitBootServices() notification, or when we get back control from the
+ * bootloader. As SetVariable() may not be called above TPL_CALLBACK, the
+ * notification runs at that TPL, after the variable driver may have switched
+ * to runtime mode, which some firmwares don't expect, and on these the
+ * histograms are only recorded if the bootloader returns.
+ * The hooks are installed by patching the protocol instances in place, since
+ * the driver opens these by protocol interface rather than by function.
+ */
+STATIC struct {
+	EFI_BLOCK_IO_PROTOCOL* BlockIo;
+	EFI_DISK_IO_PROTOCOL* DiskIo;
+	EFI_BLOCK_READ ReadBlocks;
+	EFI_DISK_READ ReadDisk;
+	EFI_EVENT ExitBootServicesEvent;
+	BOOLEAN Written;
+	READ_HISTOGRAM BlockIoHistogram;
+	READ_HISTOGRAM DiskIoHistogram;
+} ReadStats = { 0 };
+
+/*
+ * Return the index of the bucket Value falls into.
+ */
+STATIC UINTN GetBucket(CONST UINT32* Bound, CONST UINTN BoundCount, CONST UINT64 Value)
+{
+	UINTN i;
+
+	for (i = 0; i < BoundCount && Value >= Bound[i]; i++);
+	return i;
+}
+
+/*
+ * Add a read to a histogram. Start and End are expressed in the units of
+ * the layer (bytes for DiskIo and blocks for BlockIo).
+ */
+STATIC VOID RecordRead(READ_HISTOGRAM* Histogram, CONST UINT64 Start, CONST UINT64 End,
+	CONST UINTN Size, CONST UINT64 Ticks, CONST EFI_STATUS Status)
+{
+	Histogram->Reads++;
+	if (EFI_ERROR(Status)) {
+		Histogram->Errors++;
+		return;
+	}
+	Histogram->Bytes += Size;
+	Histogram->Ticks += Ticks;
+	if (Start == Histogram->NextStart)
+		Histogram->Sequential++;
+	Histogram->NextStart = End;
+	Histogram->Latency[GetBucket(LatencyBound, ARRAY_SIZE(LatencyBound), TicksToMicroseconds(Ticks))]++;
+	Histogram->Size[GetBucket(SizeBound, ARRAY_SIZE(SizeBound), Size)]++;
+}
+
+STATIC EFI_STATUS EFIAPI ReadBlocksHook(EFI_BLOCK_IO_PROTOCOL* This, UINT32 MediaId, EFI_LBA Lba,
+	UINTN BufferSize, VOID* Buffer)
+{
+	EFI_STATUS Status;
+	UINT64 Start = GetTimestamp();
+
+	Status = ReadStats.ReadBlocks(This, MediaId, Lba, BufferSize, Buffer);
+	RecordRead(&ReadStats.BlockIoHistogram, Lba, Lba + BufferSize / This->Media->BlockSize,
+		BufferSize, GetTimestamp() - Start, Status);
+	return Status;
+}
+
+STATIC EFI_STATUS EFIAPI ReadDiskHook(EFI_DISK_IO_PROTOCOL* This, UINT32 MediaId, UINT64 Offset,
+	UINTN BufferSize, VOID* Buffer)
+{
+	EFI_STATUS Status;
+	UINT64 Start = GetTimestamp();
+
+	Status = ReadStats.ReadDisk(This, MediaId, Offset, BufferSize, Buffer);
+	RecordRead(&ReadStats.DiskIoHistogram, Offset, Offset + BufferSize, BufferSize,
+		GetTimestamp() - Start, Status);
+	return Status;
+}
+
+/*
+ * Append the text form of a histogram to Data.
+ */
+STATIC UINTN FormatHistogram(CHAR16* Data, CONST UINTN Size, CONST CHAR16* Layer,
+	CONST READ_HISTOGRAM* Histogram)
+{
+	UINTN i, Length;
+
+	Length = UnicodeSPrint(Data, Size, L"%s reads=%ld bytes=%ld us=%ld sequential=%ld errors=%ld\n%s latency",
+		Layer, Histogram->Reads, Histogram->Bytes, TicksToMicroseconds(Histogram->Ticks),
+		Histogram->Sequential, Histogram->Errors, Layer);
+	for (i = 0; i < ARRAY_SIZE(LatencyBound); i++)
+		Length += UnicodeSPrint(&Data[Length], Size - Length * sizeof(CHAR16), L" <%dus=%d",
+			LatencyBound[i], Histogram->Latency[i]);
+	Length += UnicodeSPrint(&Data[Length], Size - Length * sizeof(CHAR16), L" more=%d\n%s size",
+		Histogram->Latency[i], Layer);
+	for (i = 0; i < ARRAY_SIZE(SizeBound); i++)
+		Length += UnicodeSPrint(&Data[Length], Size - Length * sizeof(CHAR16), L" <%d=%d",
+			SizeBound[i], Histogram->Size[i]);
+	Length += UnicodeSPrint(&Data[Length], Size - Length * sizeof(CHAR16), L" more=%d\n",
+		Histogram->Size[i]);
+	return Length;
+}
+
+/*
+ * Record the histograms to a non-volatile variable, so that they can be
+ * retrieved from the OS or from the UEFI Shell after the boot.
+ * NB: This may be called from an ExitBootServices() notification, where
+ * we can't allocate memory, so we use a buffer on the stack.
+ */
+STATIC VOID WriteReadStats(VOID)
+{
+	CHAR16 Data[READ_STATS_MAX_SIZE];
+	UINTN Length;
+
+	if (ReadStats.Written)
+		return;
+	ReadStats.Written = TRUE;
+	Length = UnicodeSPrint(Data, sizeof(Data), L"readstats 1\n");
+	Length += FormatHistogram(&Data[Length], sizeof(Data) - Length * sizeof(CHAR16),
+		L"diskio", &ReadStats.DiskIoHistogram);
+	Length += FormatHistogram(&Data[Length], sizeof(Data) - Length * sizeof(CHAR16),
+		L"blockio", &ReadStats.BlockIoHistogram);
+	gRT->SetVariable(READ_STATS_VARIABLE, &gUefiNtfsVariableGuid, EFI_VARIABLE_NON_VOLATILE |
+		EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS, (Length + 1) * sizeof(CHAR16), Data);
+}
+
+STATIC VOID EFIAPI OnExitBootServices(EFI_EVENT Event, VOID* Context)
+{
+	WriteReadStats();
+}
+
+/*
+ * Start recording the reads that are issued to the target partition, if requested.
+ */
+VOID StartReadStats(CONST EFI_HANDLE TargetHandle)
+{
+	EFI_STATUS Status;
+	UINT8 Enabled;
+	UINTN Size = sizeof(Enabled);
+
+	// The content of the variable doesn't matter, only whether it exists
+	Status = gRT->GetVariable(L"ReadStats", &gUefiNtfsVariableGuid, NULL, &Size, &Enabled);
+	if ((Status != EFI_SUCCESS) && (Status != EFI_BUFFER_TOO_SMALL))
+		return;
+	if (ReadStats.ExitBootServicesEvent != NULL)
+		return;
+
+	Status = gBS->CreateEvent(EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_CALLBACK, OnExitBootServices, NULL,
+		&ReadStats.ExitBootServicesEvent);
+	if (EFI_ERROR(Status)) {
+		PrintWarning(L"Could not create read statistics event: %r", Status);
+		return;
+	}
+	ZeroMem(&ReadStats.BlockIoHistogram, sizeof(ReadStats.BlockIoHistogram));
+	ZeroMem(&ReadStats.DiskIoHistogram, sizeof(ReadStats.DiskIoHistogram));
+	ReadStats.BlockIoHistogram.NextStart = (UINT64)-1;
+	ReadStats.DiskIoHistogram.NextStart = (UINT64)-1;
+	ReadStats.Written = FALSE;
+	// Calibrate the counter now, rather than from the first read we record
+	TicksToMicroseconds(0);
+
+	if (gBS->OpenProtocol(TargetHandle, &gEfiBlockIoProtocolGuid, (VOID**)&ReadStats.BlockIo,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL) == EFI_SUCCESS) {
+		ReadStats.ReadBlocks = ReadStats.BlockIo->ReadBlocks;
+		ReadStats.BlockIo->ReadBlocks = ReadBlocksHook;
+	} else {
+		ReadStats.BlockIo = NULL;
+	}
+	if (gBS->OpenProtocol(TargetHandle, &gEfiDiskIoProtocolGuid, (VOID**)&ReadStats.DiskIo,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL) == EFI_SUCCESS) {
+		ReadStats.ReadDisk = ReadStats.DiskIo->ReadDisk;
+		ReadStats.DiskIo->ReadDisk = ReadDiskHook;
+	} else {
+		ReadStats.DiskIo = NULL;
+	}
+	PrintInfo(L"Recording read statistics to '%s'", READ_STATS_VARIABLE);
+}
+
+/*
+ * Remove our hooks, which must not outlive our image, and record the
+ * histograms if ExitBootServices() didn't get to do it.
+ */
+VOID StopReadStats(VOID)
+{
+	if (ReadStats.ExitBootServicesEvent == NULL)
+		return;
+	gBS->CloseEvent(ReadStats.ExitBootServicesEvent);
+	ReadStats.ExitBootServicesEvent = NULL;
+	if (ReadStats.BlockIo != NULL && ReadStats.BlockIo->ReadBlocks == ReadBlocksHook)
+		ReadStats.BlockIo->ReadBlocks = ReadStats.ReadBlocks;
+	if (ReadStats.DiskIo != NULL && ReadStats.DiskIo->ReadDisk == ReadDiskHook)
+		ReadStats.DiskIo->ReadDisk = ReadStats.ReadDisk;
+	ReadStats.BlockIo = NULL;
+	ReadStats.DiskIo = NULL;
+	WriteReadStats();
+}
+
+#endif /* NO_READ_STATS */
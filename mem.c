@@ -0,0 +1,197 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Memory primitives
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+#if defined(__MAKEWITH_GNUEFI) && defined(__GNUC__)
+
+/*
+ * The CompareMem(), CopyMem() and ZeroMem() from gnu-efi are byte loops, so,
+ * for gnu-efi builds with GCC or Clang, boot.h redirects them to the versions
+ * below, that work on 16 bytes at a time with SSE2 on x64 and Advanced SIMD on
+ * ARM64, and on a native word at a time everywhere else. EDK2 has its own
+ * optimized versions. MSVC, which has no equivalent of the Makefile's
+ * -fno-tree-loop-distribute-patterns, keeps using the gnu-efi ones.
+ *
+ * The x64 and AArch64 UEFI bindings have the firmware enable SSE2 and Advanced
+ * SIMD for boot services, and save their state on interrupts, so we can use
+ * them as is. IA32 firmwares don't have to enable SSE, so IA32 uses words.
+ */
+#if defined(_M_X64) || defined(__x86_64__)
+#include <emmintrin.h>
+typedef __m128i CHUNK;
+#define CHUNK_ALIGN             1
+#define ChunkLoad(p)            _mm_loadu_si128((CONST __m128i*)(p))
+#define ChunkStore(p, c)        _mm_storeu_si128((__m128i*)(p), (c))
+#define ChunkZero()             _mm_setzero_si128()
+#define ChunkSplat(b)           _mm_set1_epi8((CHAR8)(b))
+#define ChunkEqual(a, b)        (_mm_movemask_epi8(_mm_cmpeq_epi8((a), (b))) == 0xFFFF)
+#define ChunkHasByte(c, s)      (_mm_movemask_epi8(_mm_cmpeq_epi8((c), (s))) != 0)
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#include <arm_neon.h>
+typedef uint8x16_t CHUNK;
+#define CHUNK_ALIGN             1
+#define ChunkLoad(p)            vld1q_u8((CONST UINT8*)(p))
+#define ChunkStore(p, c)        vst1q_u8((UINT8*)(p), (c))
+#define ChunkZero()             vdupq_n_u8(0)
+#define ChunkSplat(b)           vdupq_n_u8(b)
+#define ChunkEqual(a, b)        (vminvq_u8(vceqq_u8((a), (b))) == 0xFF)
+#define ChunkHasByte(c, s)      (vmaxvq_u8(vceqq_u8((c), (s))) != 0)
+#else
+typedef UINTN CHUNK;
+#define CHUNK_ALIGN             sizeof(UINTN)
+#define ChunkLoad(p)            (*(CONST UINTN*)(p))
+#define ChunkStore(p, c)        (*(UINTN*)(p) = (c))
+#define ChunkZero()             ((UINTN)0)
+#define ChunkSplat(b)           ((UINTN)-1 / 0xFF * (UINT8)(b))
+#define ChunkEqual(a, b)        ((a) == (b))
+/* A word has a zero byte if subtracting 1 from each byte borrows into its top bit */
+#define ChunkHasByte(c, s)      ((((c) ^ (s)) - ChunkSplat(0x01)) & ~((c) ^ (s)) & ChunkSplat(0x80))
+#endif
+
+#define CHUNK_SIZE              sizeof(CHUNK)
+
+/* Whether we can access a chunk at p. Vector loads and stores don't need alignment */
+#define IsChunkAligned(p)       (((UINTN)(p) & (CHUNK_ALIGN - 1)) == 0)
+
+/*
+ * CompareMem() replacement. Returns the difference of the first mismatched
+ * bytes, or 0 if both buffers are the same.
+ */
+INTN FastCompareMem(CONST VOID* Buffer1, CONST VOID* Buffer2, UINTN Length)
+{
+	CONST UINT8 *p = Buffer1, *q = Buffer2;
+
+	for (; Length > 0 && !IsChunkAligned(p); Length--, p++, q++) {
+		if (*p != *q)
+			return (INTN)*p - (INTN)*q;
+	}
+	if (IsChunkAligned(q)) {
+		for (; Length >= CHUNK_SIZE && ChunkEqual(ChunkLoad(p), ChunkLoad(q));
+			Length -= CHUNK_SIZE, p += CHUNK_SIZE, q += CHUNK_SIZE);
+	}
+	// This also locates the mismatch in the chunk we stopped at, if any
+	for (; Length > 0; Length--, p++, q++) {
+		if (*p != *q)
+			return (INTN)*p - (INTN)*q;
+	}
+	return 0;
+}
+
+/*
+ * CopyMem() replacement, that handles overlapping buffers.
+ */
+VOID FastCopyMem(VOID* Destination, CONST VOID* Source, UINTN Length)
+{
+	UINT8* d = Destination;
+	CONST UINT8* s = Source;
+
+	// Overlapping copies to a higher address must be done backwards. We only
+	// ever need these for small array shifts, so bytes are good enough.
+	if (d > s && d < s + Length) {
+		while (Length-- > 0)
+			d[Length] = s[Length];
+		return;
+	}
+	for (; Length > 0 && !IsChunkAligned(d); Length--)
+		*d++ = *s++;
+	if (IsChunkAligned(s)) {
+		for (; Length >= CHUNK_SIZE; Length -= CHUNK_SIZE, d += CHUNK_SIZE, s += CHUNK_SIZE)
+			ChunkStore(d, ChunkLoad(s));
+	}
+	for (; Length > 0; Length--)
+		*d++ = *s++;
+}
+
+/*
+ * ZeroMem() replacement.
+ */
+VOID FastZeroMem(VOID* Buffer, UINTN Length)
+{
+	UINT8* p = Buffer;
+
+	for (; Length > 0 && !IsChunkAligned(p); Length--)
+		*p++ = 0;
+	for (; Length >= CHUNK_SIZE; Length -= CHUNK_SIZE, p += CHUNK_SIZE)
+		ChunkStore(p, ChunkZero());
+	for (; Length > 0; Length--)
+		*p++ = 0;
+}
+
+/*
+ * Equivalent of EDK2's ScanMem8(), which gnu-efi doesn't have. Returns a
+ * pointer to the first occurrence of Value in Buffer, or NULL if not found.
+ */
+VOID* FastScanMem8(CONST VOID* Buffer, UINTN Length, CONST UINT8 Value)
+{
+	CONST UINT8* p = Buffer;
+	CHUNK Splat = ChunkSplat(Value);
+
+	for (; Length > 0 && !IsChunkAligned(p); Length--, p++) {
+		if (*p == Value)
+			return (VOID*)p;
+	}
+	for (; Length >= CHUNK_SIZE && !ChunkHasByte(ChunkLoad(p), Splat); Length -= CHUNK_SIZE, p += CHUNK_SIZE);
+	for (; Length > 0; Length--, p++) {
+		if (*p == Value)
+			return (VOID*)p;
+	}
+	return NULL;
+}
+
+#endif /* __MAKEWITH_GNUEFI && __GNUC__ */
+
+#if defined(__MAKEWITH_GNUEFI) && !defined(__GNUC__)
+/*
+ * gnu-efi has no ScanMem8(), so MSVC builds, that don't get the one above,
+ * use a byte loop, like the other gnu-efi primitives they use.
+ */
+STATIC VOID* ScanMem8(CONST VOID* Buffer, UINTN Length, CONST UINT8 Value)
+{
+	CONST UINT8* p = Buffer;
+
+	for (; Length > 0; Length--, p++) {
+		if (*p == Value)
+			return (VOID*)p;
+	}
+	return NULL;
+}
+#endif
+
+/*
+ * Return a pointer to the first occurrence of Pattern in Buffer, or NULL
+ * if not found. This skips to the candidate positions with ScanMem8(),
+ * rather than calling CompareMem() at every offset.
+ */
+VOID* FindMem(CONST VOID* Buffer, CONST UINTN Length, CONST VOID* Pattern, CONST UINTN PatternLength)
+{
+	CONST UINT8 *p = Buffer, *End;
+
+	if (PatternLength == 0 || Length < PatternLength)
+		return NULL;
+	End = p + Length - PatternLength + 1;
+	while (p < End) {
+		p = ScanMem8(p, (UINTN)(End - p), *(CONST UINT8*)Pattern);
+		if (p == NULL)
+			return NULL;
+		if (CompareMem(p, Pattern, PatternLength) == 0)
+			return (VOID*)p;
+		p++;
+	}
+	return NULL;
+}
@@ -34,21 +34,39 @@ STATIC EFI_DEVICE_PATH* GetLastDevicePath(CONST EFI_DEVICE_PATH_PROTOCOL* dp)
 	return p;
 }
 
+/* Return the size of a device path, including the end node */
+UINTN GetDevicePathLength(CONST EFI_DEVICE_PATH* dp)
+{
+	CONST EFI_DEVICE_PATH* p;
+
+	for (p = dp; !IsDevicePathEnd(p); p = NextDevicePathNode(p));
+
+	return (UINTN)p - (UINTN)dp + DevicePathNodeLength(p);
+}
+
 /*
  * Get the parent device in an EFI_DEVICE_PATH
- * Note: the returned device path is allocated and must be freed
+ * Note: the returned device path is allocated and must be freed with ArenaFree()
  */
 EFI_DEVICE_PATH* GetParentDevice(CONST EFI_DEVICE_PATH* DevicePath)
 {
 	EFI_DEVICE_PATH *dp, *ldp;
+	UINTN Len;
 
-	dp = DuplicateDevicePath((EFI_DEVICE_PATH*)DevicePath);
+	if (DevicePath == NULL)
+		return NULL;
+
+	Len = GetDevicePathLength(DevicePath);
+	dp = ArenaAllocate(Len);
 	if (dp == NULL)
 		return NULL;
+	CopyMem(dp, DevicePath, Len);
 
 	ldp = GetLastDevicePath(dp);
-	if (ldp == NULL)
+	if (ldp == NULL) {
+		ArenaFree(dp);
 		return NULL;
+	}
 
 	ldp->Type = END_DEVICE_PATH_TYPE;
 	ldp->SubType = END_ENTIRE_DEVICE_PATH_SUBTYPE;
@@ -119,7 +137,7 @@ EFI_STATUS SetPathCase(CONST EFI_FILE_HANDLE Root, CHAR16* Path)
 	if ((Root == NULL) || (Path == NULL) || (Path[0] != L'\\'))
 		return EFI_INVALID_PARAMETER;
 
-	FileInfo = (EFI_FILE_INFO*)AllocatePool(FileInfoSize);
+	FileInfo = (EFI_FILE_INFO*)ArenaAllocate(FileInfoSize);
 	if (FileInfo == NULL)
 		return EFI_OUT_OF_RESOURCES;
 
@@ -163,10 +181,11 @@ out:
 	Path[i] = L'\\';
 	if (FileHandle != NULL)
 		FileHandle->Close(FileHandle);
-	FreePool((VOID*)FileInfo);
+	ArenaFree((VOID*)FileInfo);
 	return Status;
 }
 
+#if !defined(NO_DEVICE_PATH_FALLBACK)
 /*
  * Poor man's Device Path to string conversion, where we
  * simply convert the path buffer to hexascii.
@@ -190,7 +209,9 @@ CHAR16* DevicePathToHex(CONST EFI_DEVICE_PATH* DevicePath)
 		DevicePath = (EFI_DEVICE_PATH*)((UINT8*)DevicePath + NodeLen);
 	}
 
-	DevicePathString = AllocatePool((2 * Len + 1) * sizeof(CHAR16));
+	DevicePathString = ArenaAllocate((2 * Len + 1) * sizeof(CHAR16));
+	if (DevicePathString == NULL)
+		return NULL;
 	for (i = 0; i < Len; i++) {
 		DevicePathString[2 * i] = ((dp[i] >> 4) < 10) ?
 			((dp[i] >> 4) + '0') : ((dp[i] >> 4) - 0xa + 'A');
@@ -201,29 +222,41 @@ CHAR16* DevicePathToHex(CONST EFI_DEVICE_PATH* DevicePath)
 
 	return DevicePathString;
 }
+#endif
 
 /*
  * Convert a Device Path to a string.
- * The returned value Must be freed with FreePool().
+ * The returned value Must be freed with ArenaFree().
  */
 CHAR16* DevicePathToString(CONST EFI_DEVICE_PATH* DevicePath)
 {
-	CHAR16* DevicePathString = NULL;
-	EFI_STATUS Status;
+	CHAR16 *DevicePathString = NULL, *String;
 	EFI_DEVICE_PATH_TO_TEXT_PROTOCOL* DevicePathToText;
+	UINTN Size;
 
 	if (DevicePath == NULL)
 		return NULL;
 
 	/* On most platforms, the DevicePathToText protocol should be available */
-	Status = gBS->LocateProtocol(&gEfiDevicePathToTextProtocolGuid, NULL, (VOID**)&DevicePathToText);
-	if (Status == EFI_SUCCESS)
-		DevicePathString = DevicePathToText->ConvertDevicePathToText(DevicePath, FALSE, FALSE);
+	DevicePathToText = GetDevicePathToText();
+	if (DevicePathToText != NULL)
+		String = DevicePathToText->ConvertDevicePathToText(DevicePath, FALSE, FALSE);
 	else
-#if defined(_GNU_EFI)
-		DevicePathString = DevicePathToStr((EFI_DEVICE_PATH*)DevicePath);
+#if defined(NO_DEVICE_PATH_FALLBACK)
+		return NULL;
+#elif defined(_GNU_EFI)
+		String = DevicePathToStr((EFI_DEVICE_PATH*)DevicePath);
 #else
-		DevicePathString = DevicePathToHex(DevicePath);
+		return DevicePathToHex(DevicePath);
 #endif
+	if (String == NULL)
+		return NULL;
+
+	/* Move the firmware allocated string to the arena, so that all our strings are freed the same way */
+	Size = (StrLen(String) + 1) * sizeof(CHAR16);
+	DevicePathString = ArenaAllocate(Size);
+	if (DevicePathString != NULL)
+		CopyMem(DevicePathString, String, Size);
+	FreePool(String);
 	return DevicePathString;
 }
@@ -0,0 +1,235 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Asynchronous file prefetch
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+#if !defined(NO_PREFETCH)
+
+/* Maximum number of files we read ahead: the default NTFS and exFAT drivers */
+#define MAX_PREFETCH            2
+
+/* Largest file we read ahead. Our drivers are a few hundred KB at most */
+#define MAX_PREFETCH_SIZE       (4 * 1024 * 1024)
+
+/* How long we wait for a read to complete, in seconds */
+#define PREFETCH_TIMEOUT        5
+
+typedef struct {
+	CHAR16 Path[64];
+	EFI_FILE_HANDLE File;
+	EFI_FILE_IO_TOKEN Token;
+	UINTN Size;
+	BOOLEAN Abandoned;
+} PREFETCH_ENTRY;
+
+/*
+ * The file system drivers are read from our boot partition only after we
+ * have scanned the disk for the target, which, on slow USB media, adds the
+ * whole read to the boot time. So, when the FAT driver of the firmware
+ * supports it, we issue these reads with ReadEx() as soon as we start, and
+ * pick the data up when we need it, which lets the media and the firmware
+ * perform the reads while we disconnect drivers and probe partitions.
+ * Firmwares with no asynchronous I/O support simply complete the request
+ * before returning, in which case this does no worse than a regular read.
+ */
+STATIC struct {
+	EFI_FILE_HANDLE Root;
+	UINTN Count;
+	PREFETCH_ENTRY Entry[MAX_PREFETCH];
+} Prefetch = { 0 };
+
+/*
+ * Wait for a read to complete, then close its file. If the read doesn't
+ * complete within PREFETCH_TIMEOUT seconds, or if we can't wait for it,
+ * the entry is abandoned.
+ * NB: There is no way to cancel a file I/O token, so the buffer must not be
+ * released before this has been called, nor ever if the entry was abandoned.
+ */
+STATIC EFI_STATUS CompletePrefetch(PREFETCH_ENTRY* Entry)
+{
+	EFI_STATUS Status;
+	EFI_EVENT Events[2];
+	UINTN Index = 0, EventCount = 1;
+
+	if (Entry->File == NULL)
+		return Entry->Token.Status;
+	Events[0] = Entry->Token.Event;
+	if (gBS->CreateEvent(EVT_TIMER, 0, NULL, NULL, &Events[1]) == EFI_SUCCESS) {
+		// The timer period is expressed in units of 100 ns
+		if (gBS->SetTimer(Events[1], TimerRelative, MultU64x32(PREFETCH_TIMEOUT, 10000000)) == EFI_SUCCESS)
+			EventCount = 2;
+		else
+			gBS->CloseEvent(Events[1]);
+	}
+	Status = gBS->WaitForEvent(EventCount, Events, &Index);
+	if (EventCount == 2)
+		gBS->CloseEvent(Events[1]);
+	if (EFI_ERROR(Status) || (Index != 0)) {
+		// The firmware may still complete the read, into the buffer and the
+		// token, so we leave the whole entry, and its file, as they are
+		PrintWarning(L"Could not complete reading '%s' ahead: %r", Entry->Path,
+			EFI_ERROR(Status) ? Status : EFI_TIMEOUT);
+		Entry->Abandoned = TRUE;
+		Entry->File = NULL;
+		Entry->Token.Status = EFI_TIMEOUT;
+		return EFI_TIMEOUT;
+	}
+	gBS->CloseEvent(Entry->Token.Event);
+	Entry->Token.Event = NULL;
+	Entry->File->Close(Entry->File);
+	Entry->File = NULL;
+	if ((Entry->Token.Status == EFI_SUCCESS) && (Entry->Token.BufferSize != Entry->Size))
+		Entry->Token.Status = EFI_END_OF_FILE;
+	return Entry->Token.Status;
+}
+
+/*
+ * Start reading file Path from the volume of DeviceHandle in the background.
+ * Only one volume can be read from at a time.
+ */
+VOID StartPrefetch(CONST EFI_HANDLE DeviceHandle, CONST CHAR16* Path)
+{
+	EFI_STATUS Status;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	EFI_FILE_INFO* FileInfo = NULL;
+	PREFETCH_ENTRY* Entry;
+	UINTN Size;
+
+	if (Prefetch.Count >= ARRAY_SIZE(Prefetch.Entry))
+		return;
+	if (Prefetch.Root == NULL) {
+		if ((gBS->OpenProtocol(DeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Volume,
+			MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL) != EFI_SUCCESS) ||
+			(Volume->OpenVolume(Volume, &Prefetch.Root) != EFI_SUCCESS)) {
+			Prefetch.Root = NULL;
+			return;
+		}
+	}
+	// ReadEx() was only introduced with revision 2 of the file protocol
+	if (Prefetch.Root->Revision < EFI_FILE_PROTOCOL_REVISION2)
+		return;
+
+	Entry = &Prefetch.Entry[Prefetch.Count];
+	ZeroMem(Entry, sizeof(*Entry));
+	SafeStrCpy(Entry->Path, ARRAY_SIZE(Entry->Path), Path);
+	if (Prefetch.Root->Open(Prefetch.Root, &Entry->File, Entry->Path, EFI_FILE_MODE_READ, 0) != EFI_SUCCESS) {
+		Entry->File = NULL;
+		return;
+	}
+
+	Size = sizeof(EFI_FILE_INFO) + PATH_MAX * sizeof(CHAR16);
+	FileInfo = (EFI_FILE_INFO*)ArenaAllocate(Size);
+	Status = (FileInfo == NULL) ? EFI_OUT_OF_RESOURCES :
+		Entry->File->GetInfo(Entry->File, &gEfiFileInfoGuid, &Size, FileInfo);
+	if (EFI_ERROR(Status))
+		goto out;
+	if ((FileInfo->FileSize == 0) || (FileInfo->FileSize > MAX_PREFETCH_SIZE)) {
+		Status = EFI_UNSUPPORTED;
+		goto out;
+	}
+	Entry->Size = (UINTN)FileInfo->FileSize;
+	Entry->Token.BufferSize = Entry->Size;
+	Entry->Token.Buffer = AllocatePool(Entry->Size);
+	if (Entry->Token.Buffer == NULL) {
+		Status = EFI_OUT_OF_RESOURCES;
+		goto out;
+	}
+	Status = gBS->CreateEvent(0, 0, NULL, NULL, &Entry->Token.Event);
+	if (EFI_ERROR(Status)) {
+		Entry->Token.Event = NULL;
+		goto out;
+	}
+	Status = Entry->File->ReadEx(Entry->File, &Entry->Token);
+
+out:
+	SafeArenaFree(FileInfo);
+	if (!EFI_ERROR(Status)) {
+		Prefetch.Count++;
+		return;
+	}
+	// The read was not queued, so nothing else references the token
+	if (Entry->Token.Event != NULL)
+		gBS->CloseEvent(Entry->Token.Event);
+	if (Entry->Token.Buffer != NULL)
+		SafeFree(Entry->Token.Buffer);
+	Entry->File->Close(Entry->File);
+	ZeroMem(Entry, sizeof(*Entry));
+}
+
+/*
+ * Return the content of file Path, if it was read ahead successfully, along
+ * with its Size. The returned buffer belongs to the caller and must be freed
+ * with FreePool().
+ */
+VOID* GetPrefetchedFile(CONST CHAR16* Path, UINTN* Size)
+{
+	EFI_STATUS Status;
+	PREFETCH_ENTRY* Entry = NULL;
+	VOID* Buffer;
+	UINTN i;
+
+	for (i = 0; i < Prefetch.Count; i++) {
+		if ((!Prefetch.Entry[i].Abandoned) && (Prefetch.Entry[i].Token.Buffer != NULL) &&
+			(StrCmp(Prefetch.Entry[i].Path, Path) == 0)) {
+			Entry = &Prefetch.Entry[i];
+			break;
+		}
+	}
+	if (Entry == NULL)
+		return NULL;
+
+	Status = CompletePrefetch(Entry);
+	if (Entry->Abandoned)
+		return NULL;
+	Buffer = Entry->Token.Buffer;
+	Entry->Token.Buffer = NULL;
+	if (Status != EFI_SUCCESS) {
+		SafeFree(Buffer);
+		return NULL;
+	}
+	*Size = Entry->Size;
+	return Buffer;
+}
+
+/*
+ * Wait for the reads we still have in flight, and release everything, unless
+ * a read was abandoned, in which case its buffer is leaked, and the entries
+ * and volume are kept, as the firmware may still write to them.
+ */
+VOID StopPrefetch(VOID)
+{
+	UINTN i;
+	BOOLEAN Abandoned = FALSE;
+
+	for (i = 0; i < Prefetch.Count; i++) {
+		CompletePrefetch(&Prefetch.Entry[i]);
+		if (Prefetch.Entry[i].Abandoned) {
+			Abandoned = TRUE;
+			continue;
+		}
+		if (Prefetch.Entry[i].Token.Buffer != NULL)
+			SafeFree(Prefetch.Entry[i].Token.Buffer);
+	}
+	if (Abandoned)
+		return;
+	if (Prefetch.Root != NULL)
+		Prefetch.Root->Close(Prefetch.Root);
+	ZeroMem(&Prefetch, sizeof(Prefetch));
+}
+
+#endif /* NO_PREFETCH */
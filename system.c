@@ -19,6 +19,10 @@
 
 #include "boot.h"
 
+/* Vendor GUID for the UEFI:NTFS variables */
+EFI_GUID gUefiNtfsVariableGuid = UEFI_NTFS_VARIABLE_GUID;
+
+#if !defined(NO_SYSTEM_INFO)
 /*
  * Read a system configuration table from a TableGuid.
  */
@@ -73,20 +77,25 @@ STATIC CHAR8* GetSmbiosString(SMBIOS_STRUCTURE_POINTER* Smbios, UINT16 StringNum
 	return NULL;
 }
 
+/* Indexed SMBIOS structures (first instance of each type) */
+STATIC SMBIOS_STRUCTURE* SmbiosIndex[0x80] = { 0 };
+STATIC EFI_STATUS SmbiosIndexStatus = EFI_NOT_STARTED;
+
 /*
- * Query SMBIOS to display some info about the system hardware and UEFI firmware.
+ * Walk the SMBIOS table once, and index the structures we may need to look up.
  */
-EFI_STATUS PrintSystemInfo(VOID)
+STATIC EFI_STATUS IndexSmbios(VOID)
 {
 	EFI_STATUS Status;
 	SMBIOS_STRUCTURE_POINTER Smbios;
 	SMBIOS_TABLE_ENTRY_POINT* SmbiosTable;
 	SMBIOS_TABLE_3_0_ENTRY_POINT* Smbios3Table;
-	UINT8 Found = 0, *Raw;
+	UINT8* Raw;
 	UINTN MaximumSize, ProcessedSize = 0;
 
-	PrintInfo(L"UEFI v%d.%d (%s, 0x%08X)", gST->Hdr.Revision >> 16, gST->Hdr.Revision & 0xFFFF,
-		gST->FirmwareVendor, gST->FirmwareRevision);
+	if (SmbiosIndexStatus != EFI_NOT_STARTED)
+		return SmbiosIndexStatus;
+	SmbiosIndexStatus = EFI_NOT_FOUND;
 
 	Status = GetSystemConfigurationTable(&gEfiSmbios3TableGuid, (VOID**)&Smbios3Table);
 	if (Status == EFI_SUCCESS) {
@@ -95,39 +104,179 @@ EFI_STATUS PrintSystemInfo(VOID)
 	} else {
 		Status = GetSystemConfigurationTable(&gEfiSmbiosTableGuid, (VOID**)&SmbiosTable);
 		if (EFI_ERROR(Status))
-			return EFI_NOT_FOUND;
+			return SmbiosIndexStatus;
 		Smbios.Hdr = (SMBIOS_STRUCTURE*)(UINTN)SmbiosTable->TableAddress;
 		MaximumSize = (UINTN)SmbiosTable->TableLength;
 	}
 	// Sanity check
 	if (MaximumSize > 1024 * 1024) {
 		PrintWarning(L"Aborting system report due to unexpected SMBIOS table length (0x%08X)", MaximumSize);
-		return EFI_ABORTED;
+		SmbiosIndexStatus = EFI_ABORTED;
+		return SmbiosIndexStatus;
 	}
 
-	while ((Smbios.Hdr->Type != 0x7F) && (Found < 2)) {
+	while (Smbios.Hdr->Type != 0x7F) {
 		Raw = Smbios.Raw;
-		if (Smbios.Hdr->Type == 0) {
-			PrintInfo(L"%a %a", GetSmbiosString(&Smbios, Smbios.Type0->Vendor),
-				GetSmbiosString(&Smbios, Smbios.Type0->BiosVersion));
-			Found++;
-		}
-		if (Smbios.Hdr->Type == 1) {
-			PrintInfo(L"%a %a", GetSmbiosString(&Smbios, Smbios.Type1->Manufacturer),
-				GetSmbiosString(&Smbios, Smbios.Type1->ProductName));
-			Found++;
-		}
+		if ((Smbios.Hdr->Type < ARRAY_SIZE(SmbiosIndex)) && (SmbiosIndex[Smbios.Hdr->Type] == NULL))
+			SmbiosIndex[Smbios.Hdr->Type] = Smbios.Hdr;
 		GetSmbiosString(&Smbios, 0xFFFF);
 		ProcessedSize += (UINTN)Smbios.Raw - (UINTN)Raw;
 		if (ProcessedSize > MaximumSize) {
 			PrintWarning(L"Aborting system report due to noncompliant SMBIOS");
-			return EFI_ABORTED;
+			ZeroMem(SmbiosIndex, sizeof(SmbiosIndex));
+			SmbiosIndexStatus = EFI_ABORTED;
+			return SmbiosIndexStatus;
 		}
 	}
 
+	SmbiosIndexStatus = EFI_SUCCESS;
+	return SmbiosIndexStatus;
+}
+
+/*
+ * Return the SMBIOS string referenced by the byte at FieldOffset,
+ * in the first structure of the requested type, or NULL if none.
+ */
+STATIC CHAR8* GetIndexedSmbiosString(CONST UINT8 Type, CONST UINTN FieldOffset)
+{
+	SMBIOS_STRUCTURE_POINTER Smbios;
+
+	if ((IndexSmbios() != EFI_SUCCESS) || (Type >= ARRAY_SIZE(SmbiosIndex)))
+		return NULL;
+	Smbios.Hdr = SmbiosIndex[Type];
+	if ((Smbios.Hdr == NULL) || (FieldOffset >= Smbios.Hdr->Length) || (Smbios.Raw[FieldOffset] == 0))
+		return NULL;
+	return GetSmbiosString(&Smbios, Smbios.Raw[FieldOffset]);
+}
+
+#define GetBiosVendor()     GetIndexedSmbiosString(0, OFFSET_OF(SMBIOS_TYPE0, Vendor))
+#define GetBiosVersion()    GetIndexedSmbiosString(0, OFFSET_OF(SMBIOS_TYPE0, BiosVersion))
+#define GetManufacturer()   GetIndexedSmbiosString(1, OFFSET_OF(SMBIOS_TYPE1, Manufacturer))
+#define GetProductName()    GetIndexedSmbiosString(1, OFFSET_OF(SMBIOS_TYPE1, ProductName))
+
+/*
+ * Query SMBIOS to display some info about the system hardware and UEFI firmware.
+ */
+EFI_STATUS PrintSystemInfo(VOID)
+{
+	EFI_STATUS Status;
+
+	PrintInfo(L"UEFI v%d.%d (%s, 0x%08X)", gST->Hdr.Revision >> 16, gST->Hdr.Revision & 0xFFFF,
+		gST->FirmwareVendor, gST->FirmwareRevision);
+
+	Status = IndexSmbios();
+	if (EFI_ERROR(Status))
+		return Status;
+
+	if (SmbiosIndex[0] != NULL)
+		PrintInfo(L"%a %a", GetBiosVendor(), GetBiosVersion());
+	if (SmbiosIndex[1] != NULL)
+		PrintInfo(L"%a %a", GetManufacturer(), GetProductName());
+
 	return EFI_SUCCESS;
 }
 
+/*
+ * Firmware quirks, matched against SMBIOS, where the first matching entry wins.
+ * NULL fields match anything, otherwise the SMBIOS string must start with the
+ * field. The entries below opt in the workarounds for the platforms known to
+ * need them, and every other platform, QEMU/OVMF included, gets QUIRK_DEFAULT.
+ * Platforms we can't identify, because SMBIOS is missing or was compiled out,
+ * get QUIRK_UNIDENTIFIED, which keeps all the workarounds on.
+ */
+STATIC CONST struct {
+	CONST CHAR8* BiosVendor;
+	CONST CHAR8* BiosVersion;
+	CONST CHAR8* Manufacturer;
+	CONST CHAR8* ProductName;
+	UINT32 Quirks;
+} QuirksTable[] = {
+	// HP firmwares have the partition driver open DiskIo BY_DRIVER, even when
+	// no file system is produced, which blocks our driver from connecting
+	{ NULL, NULL, "HP", NULL, QUIRK_DISCONNECT_BLOCKING_DRIVERS | QUIRK_UNLOAD_NATIVE_DRIVER },
+	{ NULL, NULL, "Hewlett-Packard", NULL, QUIRK_DISCONNECT_BLOCKING_DRIVERS | QUIRK_UNLOAD_NATIVE_DRIVER },
+	// AMI firmwares may come with the buggy native NTFS driver, which must be unloaded
+	{ "American Megatrends", NULL, NULL, NULL, QUIRK_UNLOAD_NATIVE_DRIVER },
+};
+
+/* Return TRUE if String starts with Prefix, or if Prefix is NULL */
+STATIC BOOLEAN SmbiosMatch(CONST CHAR8* Prefix, CONST CHAR8* String)
+{
+	if (Prefix == NULL)
+		return TRUE;
+	if (String == NULL)
+		return FALSE;
+	for (; *Prefix != 0; Prefix++, String++) {
+		if (*Prefix != *String)
+			return FALSE;
+	}
+	return TRUE;
+}
+#endif
+
+/*
+ * Return the set of workarounds that should be applied on this platform.
+ * For field testing, this can be overridden by setting a 32-bit 'Quirks'
+ * variable, under the UEFI:NTFS vendor GUID, to the desired QUIRK_ flags.
+ */
+UINT32 GetFirmwareQuirks(VOID)
+{
+#if defined(NO_SYSTEM_INFO)
+	STATIC UINT32 Quirks = QUIRK_UNIDENTIFIED;
+#else
+	STATIC UINT32 Quirks = QUIRK_DEFAULT;
+#endif
+	STATIC BOOLEAN Initialized = FALSE;
+	UINT32 Override;
+	UINTN Size;
+#if !defined(NO_SYSTEM_INFO)
+	UINTN Index;
+#endif
+
+	if (Initialized)
+		return Quirks;
+	Initialized = TRUE;
+
+	Size = sizeof(Override);
+	if (gRT->GetVariable(L"Quirks", &gUefiNtfsVariableGuid, NULL, &Size, &Override) == EFI_SUCCESS &&
+		Size == sizeof(Override)) {
+		Quirks = Override;
+		PrintWarning(L"Firmware quirks overridden to 0x%x", Quirks);
+		return Quirks;
+	}
+
+#if !defined(NO_SYSTEM_INFO)
+	if (GetBiosVendor() == NULL && GetManufacturer() == NULL) {
+		Quirks = QUIRK_UNIDENTIFIED;
+		return Quirks;
+	}
+	for (Index = 0; Index < ARRAY_SIZE(QuirksTable); Index++) {
+		if (SmbiosMatch(QuirksTable[Index].BiosVendor, GetBiosVendor()) &&
+			SmbiosMatch(QuirksTable[Index].BiosVersion, GetBiosVersion()) &&
+			SmbiosMatch(QuirksTable[Index].Manufacturer, GetManufacturer()) &&
+			SmbiosMatch(QuirksTable[Index].ProductName, GetProductName())) {
+			Quirks = QuirksTable[Index].Quirks;
+			PrintInfo(L"Using firmware quirks 0x%x for this platform", Quirks);
+			break;
+		}
+	}
+#endif
+
+	return Quirks;
+}
+
+/*
+ * Return the SMBIOS product name of the platform, or NULL if unknown.
+ */
+CONST CHAR8* GetPlatformName(VOID)
+{
+#if !defined(NO_SYSTEM_INFO)
+	return GetProductName();
+#else
+	return NULL;
+#endif
+}
+
 /*
  * Query the Secure Boot related firmware variables.
  * Returns:
@@ -0,0 +1,103 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Timing functions
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/* Duration of the Stall() we use to calibrate the counter, in microseconds */
+#define CALIBRATION_DELAY   1000
+
+/* Counter ticks per millisecond, or 0 if not calibrated yet */
+STATIC UINT32 TicksPerMillisecond = 0;
+
+/* gnu-efi and EDK2 don't agree on the DivU64x32() parameters */
+#if defined(_GNU_EFI)
+#define DivU64x32NoRem(Dividend, Divisor)   DivU64x32(Dividend, Divisor, NULL)
+#else
+#define DivU64x32NoRem(Dividend, Divisor)   DivU64x32(Dividend, Divisor)
+#endif
+
+/*
+ * Read the free running CPU counter. This is either the time stamp counter
+ * or the architectural timer, and returns 0 where we don't have one.
+ */
+UINT64 GetTimestamp(VOID)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	return __rdtsc();
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+	return (UINT64)_ReadStatusReg(ARM64_CNTVCT);
+#elif defined(__x86_64__) || defined(__i386__)
+	UINT32 Low, High;
+	__asm__ __volatile__ ("rdtsc" : "=a" (Low), "=d" (High));
+	return ((UINT64)High << 32) | Low;
+#elif defined(__aarch64__)
+	UINT64 Value;
+	__asm__ __volatile__ ("isb; mrs %0, cntvct_el0" : "=r" (Value));
+	return Value;
+#elif defined(__riscv) && (__riscv_xlen == 64)
+	UINT64 Value;
+	__asm__ __volatile__ ("rdtime %0" : "=r" (Value));
+	return Value;
+#elif defined(__loongarch64)
+	UINT64 Value;
+	__asm__ __volatile__ ("rdtime.d %0, $zero" : "=r" (Value));
+	return Value;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Find out the frequency of our counter. ARM64 tells us what it is, but for
+ * everything else we need to measure it against the firmware's Stall().
+ */
+STATIC VOID CalibrateCounter(VOID)
+{
+	UINT64 Start, Frequency = 0;
+
+#if defined(_MSC_VER) && defined(_M_ARM64)
+	Frequency = (UINT64)_ReadStatusReg(ARM64_CNTFRQ);
+#elif defined(__aarch64__)
+	__asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r" (Frequency));
+#endif
+	if (Frequency != 0) {
+		TicksPerMillisecond = (UINT32)DivU64x32NoRem(Frequency, 1000);
+		return;
+	}
+
+	Start = GetTimestamp();
+	gBS->Stall(CALIBRATION_DELAY);
+	TicksPerMillisecond = (UINT32)DivU64x32NoRem(GetTimestamp() - Start, CALIBRATION_DELAY / 1000);
+}
+
+/*
+ * Convert a number of counter ticks to microseconds.
+ * Returns 0 if the platform has no usable counter.
+ */
+UINT64 TicksToMicroseconds(CONST UINT64 Ticks)
+{
+	if (TicksPerMillisecond == 0)
+		CalibrateCounter();
+	if (TicksPerMillisecond == 0)
+		return 0;
+	return DivU64x32NoRem(MultU64x32(Ticks, 1000), TicksPerMillisecond);
+}
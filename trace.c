@@ -0,0 +1,207 @@
+/*
+ * uefi-ntfs: UEFI → NTFS/exFAT chain loader - Firmware topology capture
+ * Copyright © 2014-2025 Pete Batard <pete@akeo.ie>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot.h"
+
+/* Name of the trace file, created at the root of our boot partition */
+#define TRACE_FILE_NAME     L"\\uefi-ntfs.trc"
+
+/* Maximum size of the trace, in characters */
+#define TRACE_MAX_SIZE      (512 * 1024)
+
+/* Number of bytes from block 0 that we record (enough for the boot sector probes) */
+#define TRACE_BLOCK_BYTES   512
+
+/*
+ * When the "Capture" variable exists under our vendor GUID, we record what
+ * the boot process sees of the firmware: the DiskIo handles, their device
+ * paths, BlockIo media, the start of block 0 and who has DiskIo open, along
+ * with how long each of these calls took. This produces a plain text trace
+ * of the layouts that are problematic in the field, so that they can be
+ * analysed offline. Note that nothing replays these traces yet.
+ */
+STATIC struct {
+	CHAR16* Data;
+	UINTN Length;
+	BOOLEAN Truncated;
+} Trace = { 0 };
+
+/*
+ * Append a formatted line to the trace.
+ */
+STATIC VOID TraceLine(CONST CHAR16* Format, ...)
+{
+	VA_LIST Args;
+
+	if (Trace.Truncated || TRACE_MAX_SIZE - Trace.Length < STRING_MAX) {
+		Trace.Truncated = TRUE;
+		return;
+	}
+	VA_START(Args, Format);
+	Trace.Length += UnicodeVSPrint(&Trace.Data[Trace.Length], STRING_MAX * sizeof(CHAR16), Format, Args);
+	VA_END(Args);
+	Trace.Data[Trace.Length++] = L'\n';
+}
+
+/*
+ * Append a buffer to the trace, as a line of hexadecimal values.
+ */
+STATIC VOID TraceHex(CONST CHAR16* Prefix, CONST UINT8* Data, CONST UINTN Size)
+{
+	CONST CHAR16 HexDigit[] = L"0123456789abcdef";
+	UINTN Index;
+
+	if (Trace.Truncated || TRACE_MAX_SIZE - Trace.Length < 2 * Size + STRING_MAX) {
+		Trace.Truncated = TRUE;
+		return;
+	}
+	Trace.Length += UnicodeSPrint(&Trace.Data[Trace.Length], STRING_MAX * sizeof(CHAR16), L"%s", Prefix);
+	for (Index = 0; Index < Size; Index++) {
+		Trace.Data[Trace.Length++] = HexDigit[Data[Index] >> 4];
+		Trace.Data[Trace.Length++] = HexDigit[Data[Index] & 0x0f];
+	}
+	Trace.Data[Trace.Length++] = L'\n';
+}
+
+/*
+ * Record the data we collected to a file on the partition we booted from.
+ */
+STATIC EFI_STATUS WriteTrace(CONST EFI_HANDLE DeviceHandle)
+{
+	EFI_STATUS Status;
+	EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* Volume;
+	EFI_FILE_HANDLE Root = NULL, File = NULL;
+	CHAR16 Bom = 0xFEFF;
+	UINTN Size;
+
+	Status = gBS->OpenProtocol(DeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Volume,
+		MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (EFI_ERROR(Status))
+		return Status;
+	Status = Volume->OpenVolume(Volume, &Root);
+	if (EFI_ERROR(Status))
+		return Status;
+
+	// Don't leave trailing data from a previous, larger trace
+	if (Root->Open(Root, &File, TRACE_FILE_NAME, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0) == EFI_SUCCESS)
+		File->Delete(File);
+	Status = Root->Open(Root, &File, TRACE_FILE_NAME,
+		EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+	if (EFI_ERROR(Status))
+		goto out;
+	Size = sizeof(Bom);
+	Status = File->Write(File, &Size, &Bom);
+	if (EFI_ERROR(Status))
+		goto out;
+	Size = Trace.Length * sizeof(CHAR16);
+	Status = File->Write(File, &Size, Trace.Data);
+
+out:
+	if (File != NULL)
+		File->Close(File);
+	Root->Close(Root);
+	return Status;
+}
+
+/*
+ * Capture the storage topology, as seen by the boot process, if requested.
+ */
+VOID CaptureTopology(CONST EFI_HANDLE DeviceHandle)
+{
+	EFI_STATUS Status;
+	EFI_HANDLE* Handles = NULL;
+	EFI_BLOCK_IO_PROTOCOL* BlockIo;
+	EFI_OPEN_PROTOCOL_INFORMATION_ENTRY* OpenInfo;
+	CHAR16* DevicePathString;
+	UINT8* Buffer;
+	UINT8 Capture;
+	UINT64 Start;
+	UINTN Index, OpenInfoIndex, OpenInfoCount, HandleCount = 0, Size = sizeof(Capture);
+
+	// The content of the variable doesn't matter, only whether it exists
+	Status = gRT->GetVariable(L"Capture", &gUefiNtfsVariableGuid, NULL, &Size, &Capture);
+	if ((Status != EFI_SUCCESS) && (Status != EFI_BUFFER_TOO_SMALL))
+		return;
+
+	Trace.Data = AllocatePool(TRACE_MAX_SIZE * sizeof(CHAR16));
+	if (Trace.Data == NULL)
+		return;
+	Trace.Length = 0;
+	Trace.Truncated = FALSE;
+	PrintInfo(L"Capturing firmware topology");
+
+	TraceLine(L"trace 1");
+	Start = GetTimestamp();
+	Status = gBS->LocateHandleBuffer(ByProtocol, &gEfiDiskIoProtocolGuid, NULL, &HandleCount, &Handles);
+	TraceLine(L"locate DiskIo status=%r count=%d us=%ld", Status, HandleCount,
+		TicksToMicroseconds(GetTimestamp() - Start));
+	if (EFI_ERROR(Status))
+		HandleCount = 0;
+
+	for (Index = 0; Index < HandleCount; Index++) {
+		DevicePathString = DevicePathToString(DevicePathFromHandle(Handles[Index]));
+		TraceLine(L"handle %d id=%lx boot=%d path=%s", Index, (UINT64)(UINTN)Handles[Index],
+			(Handles[Index] == DeviceHandle) ? 1 : 0, (DevicePathString == NULL) ? L"-" : DevicePathString);
+		SafeArenaFree(DevicePathString);
+
+		Start = GetTimestamp();
+		Status = gBS->OpenProtocol(Handles[Index], &gEfiBlockIoProtocolGuid, (VOID**)&BlockIo,
+			MainImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+		TraceLine(L"blockio status=%r us=%ld", Status, TicksToMicroseconds(GetTimestamp() - Start));
+		if (!EFI_ERROR(Status) && BlockIo->Media != NULL) {
+			TraceLine(L"media id=%d block=%d last=%lx partition=%d removable=%d present=%d readonly=%d",
+				BlockIo->Media->MediaId, BlockIo->Media->BlockSize, BlockIo->Media->LastBlock,
+				BlockIo->Media->LogicalPartition ? 1 : 0, BlockIo->Media->RemovableMedia ? 1 : 0,
+				BlockIo->Media->MediaPresent ? 1 : 0, BlockIo->Media->ReadOnly ? 1 : 0);
+			Buffer = ArenaAllocate(BlockIo->Media->BlockSize);
+			if (Buffer != NULL) {
+				Start = GetTimestamp();
+				Status = BlockIo->ReadBlocks(BlockIo, BlockIo->Media->MediaId, 0, BlockIo->Media->BlockSize, Buffer);
+				TraceLine(L"read 0 status=%r us=%ld", Status, TicksToMicroseconds(GetTimestamp() - Start));
+				if (!EFI_ERROR(Status))
+					TraceHex(L"data ", Buffer,
+						(BlockIo->Media->BlockSize < TRACE_BLOCK_BYTES) ? BlockIo->Media->BlockSize : TRACE_BLOCK_BYTES);
+				SafeArenaFree(Buffer);
+			}
+		}
+
+		Start = GetTimestamp();
+		Status = gBS->OpenProtocolInformation(Handles[Index], &gEfiDiskIoProtocolGuid, &OpenInfo, &OpenInfoCount);
+		TraceLine(L"openinfo status=%r count=%d us=%ld", Status, EFI_ERROR(Status) ? 0 : OpenInfoCount,
+			TicksToMicroseconds(GetTimestamp() - Start));
+		if (EFI_ERROR(Status))
+			continue;
+		for (OpenInfoIndex = 0; OpenInfoIndex < OpenInfoCount; OpenInfoIndex++)
+			TraceLine(L"open agent=%lx controller=%lx attributes=%x count=%d",
+				(UINT64)(UINTN)OpenInfo[OpenInfoIndex].AgentHandle,
+				(UINT64)(UINTN)OpenInfo[OpenInfoIndex].ControllerHandle,
+				OpenInfo[OpenInfoIndex].Attributes, OpenInfo[OpenInfoIndex].OpenCount);
+		FreePool(OpenInfo);
+	}
+	if (Handles != NULL)
+		FreePool(Handles);
+	if (Trace.Truncated)
+		PrintWarning(L"Topology trace was truncated");
+
+	Status = WriteTrace(DeviceHandle);
+	if (EFI_ERROR(Status))
+		PrintErrorStatus(L"Could not write topology trace");
+	else
+		PrintInfo(L"Wrote topology trace to '%s'", &TRACE_FILE_NAME[1]);
+	SafeFree(Trace.Data);
+}